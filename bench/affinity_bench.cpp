@@ -0,0 +1,168 @@
+#include "messagebus.h"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+
+// Fan-out benchmark for CoExecutor affinity mode: every message goes to all subscribers, each of
+// which walks its own block of state, so a resume on a different core than the last one pays for
+// pulling frame and state over. Reports publish-to-handler latency and hardware cache misses.
+//
+//   affinity_bench [subscribers] [messages] [threads] [state_kb]
+
+struct PerfCounter
+{
+    PerfCounter(uint32_t type, uint64_t config)
+    {
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.disabled = 1;
+        attr.inherit = 1;           // count the executor threads spawned after this
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+    }
+    ~PerfCounter()
+    {
+        if (fd >= 0) close(fd);
+    }
+    void start()
+    {
+        if (fd < 0) return;
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+    // -1 when the counter isn't available (no PMU access, e.g. in containers)
+    int64_t stop()
+    {
+        if (fd < 0) return -1;
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        int64_t value = 0;
+        if (read(fd, &value, sizeof(value)) != sizeof(value)) return -1;
+        return value;
+    }
+    int fd = -1;
+};
+
+struct Subscriber
+{
+    std::vector<uint64_t> state;
+    std::vector<uint32_t> latencies_ns;
+    uint64_t sink = 0;
+};
+
+static int64_t now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+CoTask subscribe(MessageBus<TestMessage>* message_bus, CoExecutor* co_executor, Subscriber* subscriber, std::atomic<uint64_t>* received)
+{
+    auto await = message_bus->create_message_await(co_executor, "fanout");
+    while (true)
+    {
+        TestMessage msg = co_await await;
+        int64_t sent = 0;
+        std::memcpy(&sent, msg.data.data(), sizeof(sent));
+        subscriber->latencies_ns.push_back(static_cast<uint32_t>(std::min<int64_t>(now_ns() - sent, UINT32_MAX)));
+        uint64_t sum = 0;
+        for (uint64_t v : subscriber->state)
+        {
+            sum += v;
+        }
+        subscriber->state[sent % subscriber->state.size()] += 1;
+        subscriber->sink += sum;
+        received->fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+static void run(bool affinity, int subscriber_num, int message_num, int thread_num, int state_kb)
+{
+    PerfCounter llc_misses(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+    PerfCounter l1d_misses(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+        (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+
+    MessageBus<TestMessage> message_bus;
+    CoExecutor co_executor(thread_num);
+    co_executor.set_affinity(affinity);
+    std::vector<Subscriber> subscribers(subscriber_num);
+    std::atomic<uint64_t> received{0};
+    llc_misses.start();
+    l1d_misses.start();
+    co_executor.start();
+    for (auto& subscriber : subscribers)
+    {
+        subscriber.state.assign(static_cast<std::size_t>(state_kb) * 1024 / sizeof(uint64_t), 1);
+        subscriber.latencies_ns.reserve(message_num);
+        subscribe(&message_bus, &co_executor, &subscriber, &received);
+    }
+    std::thread dispatcher([&](){ message_bus.run(); });
+
+    auto begin = std::chrono::steady_clock::now();
+    uint64_t expected = 0;
+    for (int i = 0; i < message_num; ++i)
+    {
+        TestMessage msg;
+        msg.name = "fanout";
+        int64_t sent = now_ns();
+        msg.data.assign(reinterpret_cast<const char*>(&sent), sizeof(sent));
+        message_bus.push_message(std::move(msg));
+        expected += subscriber_num;
+        // let each message fan out before the next so latency isn't just queueing
+        while (received.load(std::memory_order_relaxed) + subscriber_num < expected)
+        {
+            std::this_thread::yield();
+        }
+    }
+    while (received.load(std::memory_order_relaxed) < expected)
+    {
+        std::this_thread::yield();
+    }
+    auto elapsed = std::chrono::steady_clock::now() - begin;
+    int64_t llc = llc_misses.stop();
+    int64_t l1d = l1d_misses.stop();
+
+    std::vector<uint32_t> latencies;
+    for (auto& subscriber : subscribers)
+    {
+        latencies.insert(latencies.end(), subscriber.latencies_ns.begin(), subscriber.latencies_ns.end());
+    }
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [&latencies](double p) { return latencies[static_cast<std::size_t>(p * (latencies.size() - 1))] / 1000.0; };
+    uint64_t steals = 0;
+    for (auto& worker : co_executor.stats().workers)
+    {
+        steals += worker.steals;
+    }
+    double deliveries = static_cast<double>(expected);
+    std::cout << (affinity ? "affinity" : "shared  ")
+        << "  msgs/s " << static_cast<uint64_t>(message_num / std::chrono::duration<double>(elapsed).count())
+        << "  p50 " << percentile(0.5) << "us  p99 " << percentile(0.99) << "us  p99.9 " << percentile(0.999) << "us"
+        << "  llc-miss/delivery " << (llc < 0 ? std::string("n/a") : std::to_string(llc / deliveries))
+        << "  l1d-miss/delivery " << (l1d < 0 ? std::string("n/a") : std::to_string(l1d / deliveries))
+        << "  steals " << steals << std::endl;
+
+    message_bus.stop();
+    dispatcher.join();
+    co_executor.stop();
+}
+
+int main(int argc, char** argv)
+{
+    int subscriber_num = argc > 1 ? std::atoi(argv[1]) : 32;
+    int message_num = argc > 2 ? std::atoi(argv[2]) : 20000;
+    int thread_num = argc > 3 ? std::atoi(argv[3]) : 4;
+    int state_kb = argc > 4 ? std::atoi(argv[4]) : 16;
+    std::cout << subscriber_num << " subscribers, " << message_num << " messages, " << thread_num
+        << " threads, " << state_kb << " KiB state per subscriber" << std::endl;
+    run(false, subscriber_num, message_num, thread_num, state_kb);
+    run(true, subscriber_num, message_num, thread_num, state_kb);
+    return 0;
+}
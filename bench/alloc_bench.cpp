@@ -0,0 +1,163 @@
+#include "messagebus.h"
+#include "sim_executor.h"
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+
+
+// Heap allocations per published message, TestMessage against BusMessage<>. Global operator
+// new is replaced with a counting one; each message is built, published, dispatched and copied
+// into two MessageAwait subscribers on this thread under a SimExecutor, so every allocation on
+// the path is counted and nothing else runs. The topic fits std::string's inline buffer, the
+// payload doesn't.
+//
+//   alloc_bench [messages]
+
+static std::atomic<uint64_t> allocations{0};
+
+void* operator new(std::size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1))
+    {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size)
+{
+    return operator new(size);
+}
+
+void* operator new(std::size_t size, std::align_val_t align)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    std::size_t alignment = static_cast<std::size_t>(align);
+    if (void* p = std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment))
+    {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size, std::align_val_t align)
+{
+    return operator new(size, align);
+}
+
+// Every delete frees through here. Inlined into a caller of operator new, a bare free() would
+// look to GCC like a new/free mismatch (-Wmismatched-new-delete), it can't know new is malloc.
+[[gnu::noinline]] static void release(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p) noexcept
+{
+    release(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+    release(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+    release(p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept
+{
+    release(p);
+}
+
+void operator delete(void* p, std::align_val_t) noexcept
+{
+    release(p);
+}
+
+void operator delete[](void* p, std::align_val_t) noexcept
+{
+    release(p);
+}
+
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept
+{
+    release(p);
+}
+
+void operator delete[](void* p, std::size_t, std::align_val_t) noexcept
+{
+    release(p);
+}
+
+static const char topic[] = "market.quotes.1";     // 15 bytes
+static const std::string payload(50, 'x');
+
+template<typename Message>
+CoTask subscriber(MessageBus<Message>* message_bus, CoExecutor* co_executor, CancellationToken token, uint64_t* received)
+{
+    auto await = message_bus->create_message_await(co_executor, topic);
+    await.set_cancellation_token(token);
+    while (true)
+    {
+        Message msg = co_await await;
+        if (await.cancelled()) break;
+        ++*received;
+    }
+}
+
+template<typename Message>
+static double run(int message_num)
+{
+    constexpr int batch = 64;
+    SimExecutor sim(0);
+    MessageBus<Message> message_bus;
+    sim.add_source([&message_bus]() { return message_bus.dispatch_one(); });
+    CancellationSource cancel;
+    uint64_t received = 0;
+    subscriber(&message_bus, &sim, cancel.token(), &received);
+    subscriber(&message_bus, &sim, cancel.token(), &received);
+    int rounds = std::max(message_num / batch, 1);
+    auto publish = [&]() {
+        for (int i = 0; i < rounds; ++i)
+        {
+            for (int j = 0; j < batch; ++j)
+            {
+                Message msg;
+                msg.name = topic;
+                msg.data = payload;
+                message_bus.push_message(std::move(msg));
+            }
+            sim.run();
+        }
+    };
+    // first pass grows the queues, ready lists and counters to their working size
+    publish();
+    uint64_t before = allocations.load();
+    publish();
+    uint64_t counted = allocations.load() - before;
+    cancel.cancel();
+    sim.run();
+    if (received != 4 * static_cast<uint64_t>(rounds) * batch)
+    {
+        std::cerr << "lost messages: " << received << " of " << 4 * rounds * batch << " received" << std::endl;
+        std::exit(1);
+    }
+    return static_cast<double>(counted) / (rounds * batch);
+}
+
+int main(int argc, char** argv)
+{
+    int message_num = argc > 1 ? std::atoi(argv[1]) : 100000;
+    std::cout << message_num << " messages, 2 subscribers, " << sizeof(topic) - 1 << " byte topic, "
+        << payload.size() << " byte payload" << std::endl;
+    double test_message = run<TestMessage>(message_num);
+    double bus_message = run<BusMessage<>>(message_num);
+    std::cout << "  TestMessage   " << test_message << " allocations/message" << std::endl;
+    std::cout << "  BusMessage<>  " << bus_message << " allocations/message" << std::endl;
+    return 0;
+}
@@ -0,0 +1,109 @@
+#include "messagebus.h"
+#include <iostream>
+
+
+// Central queue benchmark: producer threads publish as fast as they can while the dispatcher
+// drains, through the default moodycamel queue, through MpscRingQueue, and through one
+// register_publisher lane per producer, with single pushes and with batches. No topic has
+// subscribers, so the time is the queue plus the dispatcher's per-message lookups, the same
+// for every variant.
+//
+//   queue_bench [messages per producer] [batch]
+
+// same layout as TestMessage, routed through the ring
+struct RingMessage : TestMessage
+{
+};
+
+template<>
+struct BusQueue<RingMessage>
+{
+    template<typename E>
+    using type = MpscRingQueue<E>;
+};
+
+template<typename Message>
+static double run(int producer_num, int message_num, int batch, bool lanes = false)
+{
+    MessageBus<Message> message_bus;
+    std::thread dispatcher([&](){ message_bus.run(); });
+    std::atomic<int> ready{0};
+    std::atomic<bool> go{false};
+    std::vector<std::thread> producers;
+    for (int p = 0; p < producer_num; ++p)
+    {
+        producers.emplace_back([&]()
+        {
+            typename MessageBus<Message>::Publisher publisher;
+            if (lanes)
+            {
+                publisher = message_bus.register_publisher();
+            }
+            std::vector<Message> messages(batch);
+            ++ready;
+            while (!go.load(std::memory_order_acquire))
+            {
+                std::this_thread::yield();
+            }
+            for (int i = 0; i < message_num; i += batch)
+            {
+                int n = std::min(batch, message_num - i);
+                for (int j = 0; j < n; ++j)
+                {
+                    messages[j].name = "bench";
+                    messages[j].data.assign(reinterpret_cast<const char*>(&i), sizeof(i));
+                }
+                if (publisher)
+                {
+                    publisher.push_messages(messages.data(), n);
+                }else if (batch == 1)
+                {
+                    // a full ring hands the message back
+                    while (!message_bus.push_message(std::move(messages[0])))
+                    {
+                        std::this_thread::yield();
+                    }
+                }else
+                {
+                    while (!message_bus.push_messages(messages.data(), n))
+                    {
+                        std::this_thread::yield();
+                    }
+                }
+            }
+        });
+    }
+    while (ready.load() < producer_num)
+    {
+        std::this_thread::yield();
+    }
+    auto begin = std::chrono::steady_clock::now();
+    go.store(true, std::memory_order_release);
+    for (auto& producer : producers)
+    {
+        producer.join();
+    }
+    // returns once the dispatcher has taken everything that was published
+    message_bus.drain(std::chrono::seconds(60));
+    auto elapsed = std::chrono::steady_clock::now() - begin;
+    dispatcher.join();
+    return static_cast<double>(producer_num) * message_num / std::chrono::duration<double>(elapsed).count();
+}
+
+int main(int argc, char** argv)
+{
+    int message_num = argc > 1 ? std::atoi(argv[1]) : 500000;
+    int batch = argc > 2 ? std::max(1, std::atoi(argv[2])) : 16;
+    std::cout << message_num << " messages per producer, push_messages batch " << batch << std::endl;
+    for (int producer_num : {1, 4, 16})
+    {
+        std::cout << producer_num << " producers" << std::endl;
+        std::cout << "  moodycamel  push " << static_cast<uint64_t>(run<TestMessage>(producer_num, message_num, 1))
+            << " msgs/s  batch " << static_cast<uint64_t>(run<TestMessage>(producer_num, message_num, batch)) << " msgs/s" << std::endl;
+        std::cout << "  mpsc ring   push " << static_cast<uint64_t>(run<RingMessage>(producer_num, message_num, 1))
+            << " msgs/s  batch " << static_cast<uint64_t>(run<RingMessage>(producer_num, message_num, batch)) << " msgs/s" << std::endl;
+        std::cout << "  spsc lanes  push " << static_cast<uint64_t>(run<TestMessage>(producer_num, message_num, 1, true))
+            << " msgs/s  batch " << static_cast<uint64_t>(run<TestMessage>(producer_num, message_num, batch, true)) << " msgs/s" << std::endl;
+    }
+    return 0;
+}
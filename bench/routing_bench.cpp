@@ -0,0 +1,54 @@
+#include "messagebus.h"
+#include <iostream>
+
+
+// Dispatch cost of map-routed topics against the same topics declared in StaticTopics. The
+// queue is filled first, then dispatch_one drains it on this thread, so the timing is the
+// dispatcher's routing and counters alone. No topic has subscribers.
+//
+//   routing_bench [messages]
+
+struct DynamicMessage : TestMessage
+{
+};
+
+struct StaticMessage : TestMessage
+{
+};
+
+template<>
+struct StaticTopics<StaticMessage> : TopicList<"orders", "quotes", "trades", "fills", "positions", "risk", "heartbeat", "status">
+{
+};
+
+template<typename Message>
+static double run(int message_num)
+{
+    MessageBus<Message> message_bus;
+    const auto& names = StaticTopics<StaticMessage>::names;
+    for (int i = 0; i < message_num; ++i)
+    {
+        Message msg;
+        msg.name = std::string(names[i % names.size()]);
+        msg.data = "payload";
+        message_bus.push_message(std::move(msg));
+    }
+    auto begin = std::chrono::steady_clock::now();
+    while (message_bus.dispatch_one())
+    {
+    }
+    auto elapsed = std::chrono::steady_clock::now() - begin;
+    return std::chrono::duration<double, std::nano>(elapsed).count() / message_num;
+}
+
+int main(int argc, char** argv)
+{
+    int message_num = argc > 1 ? std::atoi(argv[1]) : 1000000;
+    std::cout << message_num << " messages over " << StaticTopics<StaticMessage>::size << " topics" << std::endl;
+    for (int i = 0; i < 3; ++i)
+    {
+        std::cout << "  maps    " << run<DynamicMessage>(message_num) << " ns/dispatch" << std::endl;
+        std::cout << "  static  " << run<StaticMessage>(message_num) << " ns/dispatch" << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,466 @@
+#pragma once
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstring>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include "blockingconcurrentqueue.h"
+#include "messagebus.h"
+
+
+// How a message type goes on the wire. The default covers any {name, data} message whose fields
+// convert to std::string_view and assign from it (TestMessage, BusMessage); specialize it for
+// other types. name() and data() must stay valid for as long as the message is alive.
+template<typename T>
+struct MessageCodec
+{
+    static std::string_view name(const T& message)
+    {
+        return message.name;
+    }
+    static std::string_view data(const T& message)
+    {
+        return message.data;
+    }
+    static T decode(std::string_view name, std::string_view data)
+    {
+        T message;
+        message.name = name;
+        message.data = data;
+        return message;
+    }
+};
+
+
+// Frame layout, big-endian lengths: u32 payload size | u16 name size | name | data.
+// payload size counts everything after itself.
+namespace bridge_frame
+{
+    constexpr std::size_t kHeaderSize = 6;
+    constexpr uint32_t kMaxPayload = 16 * 1024 * 1024;
+    constexpr std::size_t kMaxName = UINT16_MAX;
+
+    // false for a message the sizes can't describe or the receiver would refuse
+    inline bool fits(std::size_t name_size, std::size_t data_size)
+    {
+        return name_size <= kMaxName && data_size <= kMaxPayload - 2 - name_size;
+    }
+
+    // name_size and data_size must fit()
+    inline void write_header(char* out, std::size_t name_size, std::size_t data_size)
+    {
+        uint32_t payload = htonl(static_cast<uint32_t>(2 + name_size + data_size));
+        uint16_t name = htons(static_cast<uint16_t>(name_size));
+        std::memcpy(out, &payload, 4);
+        std::memcpy(out + 4, &name, 2);
+    }
+}
+
+
+// Socket helpers; each returns a file descriptor, or -1 with errno set.
+inline int bridge_listen_unix(const std::string& path)
+{
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    unlink(path.c_str());
+    if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 || listen(fd, 16) < 0)
+    {
+        int error = errno;
+        close(fd);
+        errno = error;
+        return -1;
+    }
+    return fd;
+}
+
+inline int bridge_connect_unix(const std::string& path)
+{
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0)
+    {
+        int error = errno;
+        close(fd);
+        errno = error;
+        return -1;
+    }
+    return fd;
+}
+
+// loopback_only binds 127.0.0.1 instead of every interface
+inline int bridge_listen_tcp(uint16_t port, bool loopback_only = true)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(loopback_only ? INADDR_LOOPBACK : INADDR_ANY);
+    if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 || listen(fd, 16) < 0)
+    {
+        int error = errno;
+        close(fd);
+        errno = error;
+        return -1;
+    }
+    return fd;
+}
+
+inline int bridge_connect_tcp(const std::string& host, uint16_t port)
+{
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* result = nullptr;
+    if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &result) != 0)
+    {
+        errno = EHOSTUNREACH;
+        return -1;
+    }
+    int fd = -1;
+    for (addrinfo* ai = result; ai; ai = ai->ai_next)
+    {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0) continue;
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) break;
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(result);
+    if (fd >= 0)
+    {
+        // frames are already batched into one sendmsg, don't let Nagle hold the tail back
+        int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    }
+    return fd;
+}
+
+inline int bridge_accept(int listen_fd)
+{
+    int fd;
+    do
+    {
+        fd = accept(listen_fd, nullptr, nullptr);
+    }while (fd < 0 && errno == EINTR);
+    return fd;
+}
+
+
+struct BridgeStats
+{
+    uint64_t messages = 0;
+    uint64_t bytes = 0;
+    uint64_t syscalls = 0;      // sendmsg or read calls
+    uint64_t partial_writes = 0;    // sends that came back short and were resumed
+    uint64_t oversized = 0;     // messages dropped unsent, their name or payload exceeds the frame limits
+    bool failed = false;        // the connection broke or carried a bad frame
+};
+
+// Forwards the given topics of a local bus over a connected stream socket. One MessageAwait per
+// topic drains its queue in batches on the executor; a writer thread turns whatever has piled up
+// into a single gathering sendmsg, pointing straight into the messages, so a burst costs one
+// syscall. A closed peer marks the sender failed (no SIGPIPE is raised). A message too large
+// for a frame is dropped and counted rather than sent, the receiver would drop the connection.
+// Don't bridge the same topic in both directions between two buses, it would loop. The
+// forwarding coroutines run on co_executor, so stop the sender (or destroy it) before stopping
+// or draining that executor.
+template<typename T>
+class BusBridgeSender
+{
+    public:
+    BusBridgeSender(MessageBus<T>* message_bus, CoExecutor* co_executor, int fd, std::vector<std::string> topics):
+        message_bus_(message_bus),
+        co_executor_(co_executor),
+        fd_(fd),
+        topics_(std::move(topics))
+    {
+    }
+    BusBridgeSender(const BusBridgeSender&) = delete;
+    BusBridgeSender& operator=(const BusBridgeSender&) = delete;
+    ~BusBridgeSender()
+    {
+        stop();
+    }
+
+    void start()
+    {
+        running_ = true;
+        writer_ = std::thread([this](){ write_loop(); });
+        for (auto& topic : topics_)
+        {
+            ++forwarding_num_;
+            forward(topic);
+        }
+    }
+
+    // stops forwarding and closes the socket; queued messages that weren't written are dropped.
+    // Waits for the forwarding coroutines to see the cancel, so co_executor must still be running.
+    void stop()
+    {
+        if (!running_.exchange(false)) return;
+        assert(co_executor_->running() && "stop the bridge before stopping or draining its executor");
+        cancel_.cancel();
+        while (forwarding_num_ > 0)
+        {
+            std::this_thread::yield();
+        }
+        // a send blocked on a peer that stopped reading returns once the socket is shut down
+        shutdown(fd_, SHUT_RDWR);
+        writer_.join();
+        close(fd_);
+    }
+
+    BridgeStats stats() const
+    {
+        return {messages_.load(std::memory_order_relaxed), bytes_.load(std::memory_order_relaxed),
+            syscalls_.load(std::memory_order_relaxed), partial_writes_.load(std::memory_order_relaxed),
+            oversized_.load(std::memory_order_relaxed), failed_.load(std::memory_order_relaxed)};
+    }
+
+    private:
+    static constexpr std::size_t kBatch = 64;
+
+    CoTask forward(std::string topic)
+    {
+        {
+            auto await = message_bus_->create_message_await(co_executor_, topic);
+            await.set_cancellation_token(cancel_.token());
+            // the coroutine may resume on any executor thread; the queue is FIFO per producer,
+            // not per thread, so one token keeps the topic in order
+            moodycamel::ProducerToken token(outgoing_);
+            T batch[kBatch];
+            while (true)
+            {
+                std::size_t n = co_await await.next_batch(batch, kBatch);
+                if (await.cancelled()) break;
+                outgoing_.enqueue_bulk(token, std::make_move_iterator(batch), n);
+            }
+        }
+        // the await has left the bus by now, stop() may return
+        --forwarding_num_;
+    }
+
+    void write_loop()
+    {
+        std::vector<T> batch(kBatch);
+        char headers[kBatch][bridge_frame::kHeaderSize];
+        iovec iov[kBatch * 3];
+        while (running_)
+        {
+            std::size_t n = outgoing_.wait_dequeue_bulk_timed(batch.begin(), kBatch, std::chrono::milliseconds(100));
+            if (n == 0 || failed_) continue;
+            int iov_num = 0;
+            std::size_t total = 0;
+            std::size_t oversized = 0;
+            for (std::size_t i = 0; i < n; ++i)
+            {
+                std::string_view name = MessageCodec<T>::name(batch[i]);
+                std::string_view data = MessageCodec<T>::data(batch[i]);
+                if (!bridge_frame::fits(name.size(), data.size()))
+                {
+                    ++oversized;
+                    continue;
+                }
+                bridge_frame::write_header(headers[i], name.size(), data.size());
+                iov[iov_num++] = {headers[i], bridge_frame::kHeaderSize};
+                iov[iov_num++] = {const_cast<char*>(name.data()), name.size()};
+                iov[iov_num++] = {const_cast<char*>(data.data()), data.size()};
+                total += bridge_frame::kHeaderSize + name.size() + data.size();
+            }
+            if (!write_all(iov, iov_num))
+            {
+                // after stop() the socket is shut down under us, that is no failure
+                if (running_) failed_ = true;
+                continue;
+            }
+            messages_.fetch_add(n - oversized, std::memory_order_relaxed);
+            bytes_.fetch_add(total, std::memory_order_relaxed);
+            oversized_.fetch_add(oversized, std::memory_order_relaxed);
+        }
+    }
+
+    bool write_all(iovec* iov, int iov_num)
+    {
+        while (iov_num > 0)
+        {
+            // writev with MSG_NOSIGNAL, a closed peer must fail the sender, not kill the process
+            msghdr message{};
+            message.msg_iov = iov;
+            message.msg_iovlen = iov_num;
+            ssize_t written = sendmsg(fd_, &message, MSG_NOSIGNAL);
+            syscalls_.fetch_add(1, std::memory_order_relaxed);
+            if (written < 0)
+            {
+                if (errno == EINTR) continue;
+                return false;
+            }
+            // skip what went out and resume inside a partially written entry
+            while (iov_num > 0 && static_cast<std::size_t>(written) >= iov->iov_len)
+            {
+                written -= iov->iov_len;
+                ++iov;
+                --iov_num;
+            }
+            if (iov_num > 0)
+            {
+                iov->iov_base = static_cast<char*>(iov->iov_base) + written;
+                iov->iov_len -= written;
+                partial_writes_.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+        return true;
+    }
+
+    MessageBus<T>* message_bus_;
+    CoExecutor* co_executor_;
+    int fd_;
+    std::vector<std::string> topics_;
+    CancellationSource cancel_;
+    moodycamel::BlockingConcurrentQueue<T> outgoing_;
+    std::thread writer_;
+    std::atomic<bool> running_ = false;
+    std::atomic<int> forwarding_num_ = 0;
+    std::atomic<uint64_t> messages_ = 0;
+    std::atomic<uint64_t> bytes_ = 0;
+    std::atomic<uint64_t> syscalls_ = 0;
+    std::atomic<uint64_t> partial_writes_ = 0;
+    std::atomic<uint64_t> oversized_ = 0;
+    std::atomic<bool> failed_ = false;
+};
+
+
+// Reads frames from a connected stream socket and publishes them on a local bus, handing every
+// complete frame of a read to push_messages in one go.
+template<typename T>
+class BusBridgeReceiver
+{
+    public:
+    BusBridgeReceiver(MessageBus<T>* message_bus, int fd):
+        message_bus_(message_bus),
+        fd_(fd)
+    {
+    }
+    BusBridgeReceiver(const BusBridgeReceiver&) = delete;
+    BusBridgeReceiver& operator=(const BusBridgeReceiver&) = delete;
+    ~BusBridgeReceiver()
+    {
+        stop();
+    }
+
+    void start()
+    {
+        running_ = true;
+        reader_ = std::thread([this](){ read_loop(); });
+    }
+
+    void stop()
+    {
+        if (!running_.exchange(false)) return;
+        shutdown(fd_, SHUT_RDWR);
+        reader_.join();
+        close(fd_);
+    }
+
+    // true once the peer closed the connection or sent a bad frame
+    bool finished() const
+    {
+        return finished_;
+    }
+
+    BridgeStats stats() const
+    {
+        return {messages_.load(std::memory_order_relaxed), bytes_.load(std::memory_order_relaxed),
+            syscalls_.load(std::memory_order_relaxed), 0, 0, failed_.load(std::memory_order_relaxed)};
+    }
+
+    private:
+    static constexpr std::size_t kReadSize = 64 * 1024;
+
+    void read_loop()
+    {
+        std::vector<char> buffer(kReadSize);
+        std::vector<T> batch;
+        std::size_t begin = 0;
+        std::size_t end = 0;
+        while (running_)
+        {
+            if (buffer.size() - end < kReadSize / 4)
+            {
+                // compact, and grow only when a single frame doesn't fit
+                std::memmove(buffer.data(), buffer.data() + begin, end - begin);
+                end -= begin;
+                begin = 0;
+                if (buffer.size() - end < kReadSize / 4)
+                {
+                    buffer.resize(buffer.size() * 2);
+                }
+            }
+            ssize_t n = read(fd_, buffer.data() + end, buffer.size() - end);
+            syscalls_.fetch_add(1, std::memory_order_relaxed);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            end += n;
+            bytes_.fetch_add(n, std::memory_order_relaxed);
+            while (end - begin >= bridge_frame::kHeaderSize)
+            {
+                uint32_t payload;
+                uint16_t name_size;
+                std::memcpy(&payload, buffer.data() + begin, 4);
+                std::memcpy(&name_size, buffer.data() + begin + 4, 2);
+                payload = ntohl(payload);
+                name_size = ntohs(name_size);
+                if (payload < 2u + name_size || payload > bridge_frame::kMaxPayload)
+                {
+                    failed_ = true;
+                    finished_ = true;
+                    return;
+                }
+                if (end - begin < 4 + payload) break;
+                const char* name = buffer.data() + begin + bridge_frame::kHeaderSize;
+                batch.push_back(MessageCodec<T>::decode({name, name_size}, {name + name_size, payload - 2u - name_size}));
+                begin += 4 + payload;
+            }
+            if (!batch.empty())
+            {
+                message_bus_->push_messages(batch.data(), batch.size());
+                messages_.fetch_add(batch.size(), std::memory_order_relaxed);
+                batch.clear();
+            }
+            if (begin == end)
+            {
+                begin = end = 0;
+            }
+        }
+        finished_ = true;
+    }
+
+    MessageBus<T>* message_bus_;
+    int fd_;
+    std::thread reader_;
+    std::atomic<bool> running_ = false;
+    std::atomic<bool> finished_ = false;
+    std::atomic<uint64_t> messages_ = 0;
+    std::atomic<uint64_t> bytes_ = 0;
+    std::atomic<uint64_t> syscalls_ = 0;
+    std::atomic<bool> failed_ = false;
+};
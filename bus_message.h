@@ -0,0 +1,218 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include "message_arena.h"
+
+
+// String with Capacity bytes of inline storage. Up to Capacity bytes it never allocates and
+// copies/moves are a fixed-size memcpy; longer values spill into MessageArena.
+template<std::size_t Capacity>
+class SmallString
+{
+    public:
+    SmallString() = default;
+    SmallString(std::string_view value)
+    {
+        assign(value);
+    }
+    SmallString(const char* value):SmallString(std::string_view(value))
+    {
+    }
+    SmallString(const std::string& value):SmallString(std::string_view(value))
+    {
+    }
+    // topic tags a spilled buffer for MessageArena::topic_live_bytes
+    SmallString(std::string_view value, std::string_view topic)
+    {
+        assign(value, topic);
+    }
+    SmallString(const SmallString& other)
+    {
+        copy(other);
+    }
+    SmallString(SmallString&& other) noexcept
+    {
+        steal(other);
+    }
+    SmallString& operator=(const SmallString& other)
+    {
+        if (this != &other)
+        {
+            copy(other);
+        }
+        return *this;
+    }
+    SmallString& operator=(SmallString&& other) noexcept
+    {
+        if (this != &other)
+        {
+            release();
+            steal(other);
+        }
+        return *this;
+    }
+    SmallString& operator=(std::string_view value)
+    {
+        assign(value);
+        return *this;
+    }
+    SmallString& operator=(const std::string& value)
+    {
+        assign(value);
+        return *this;
+    }
+    SmallString& operator=(const char* value)
+    {
+        assign(value);
+        return *this;
+    }
+    ~SmallString()
+    {
+        release();
+    }
+
+    const char* data() const
+    {
+        return heap_ ? heap_ : inline_;
+    }
+    std::size_t size() const
+    {
+        return size_;
+    }
+    bool empty() const
+    {
+        return size_ == 0;
+    }
+    bool spilled() const
+    {
+        return heap_ != nullptr;
+    }
+    std::string_view view() const
+    {
+        return {data(), size_};
+    }
+    operator std::string_view() const
+    {
+        return view();
+    }
+    std::string str() const
+    {
+        return std::string(view());
+    }
+    static constexpr std::size_t capacity()
+    {
+        return Capacity;
+    }
+
+    // a spilled buffer is accounted to topic; plain assignment keeps the current buffer's topic
+    void assign(std::string_view value, std::string_view topic)
+    {
+        assign(value, [&]{ return MessageArena::instance().allocate(value.size(), topic); });
+    }
+
+    // sizes the string to size bytes, contents unspecified, and returns them to be filled in place
+    char* prepare(std::size_t size, std::string_view topic = {})
+    {
+        if (size <= Capacity)
+        {
+            release();
+        }else if (heap_capacity_ < size)
+        {
+            char* heap = MessageArena::instance().allocate(size, topic);
+            release();
+            heap_ = heap;
+            heap_capacity_ = size;
+        }
+        size_ = static_cast<uint32_t>(size);
+        return heap_ ? heap_ : inline_;
+    }
+
+    private:
+    void assign(std::string_view value)
+    {
+        assign(value, [&]{
+            return heap_ ? MessageArena::instance().allocate_like(value.size(), heap_)
+                         : MessageArena::instance().allocate(value.size());
+        });
+    }
+    void copy(const SmallString& other)
+    {
+        assign(other.view(), [&]{
+            return other.heap_ ? MessageArena::instance().allocate_like(other.size_, other.heap_)
+                               : MessageArena::instance().allocate(other.size_);
+        });
+    }
+    template<typename Allocate>
+    void assign(std::string_view value, Allocate&& allocate)
+    {
+        if (value.size() <= Capacity)
+        {
+            std::memmove(inline_, value.data(), value.size());
+            release();
+        }else
+        {
+            if (heap_capacity_ < value.size())
+            {
+                char* heap = allocate();
+                std::memcpy(heap, value.data(), value.size());
+                release();
+                heap_ = heap;
+                heap_capacity_ = value.size();
+            }else
+            {
+                std::memmove(heap_, value.data(), value.size());
+            }
+        }
+        size_ = static_cast<uint32_t>(value.size());
+    }
+    void steal(SmallString& other)
+    {
+        if (other.heap_)
+        {
+            heap_ = other.heap_;
+            heap_capacity_ = other.heap_capacity_;
+            other.heap_ = nullptr;
+            other.heap_capacity_ = 0;
+        }else
+        {
+            std::memcpy(inline_, other.inline_, other.size_);
+        }
+        size_ = other.size_;
+        other.size_ = 0;
+    }
+    void release()
+    {
+        if (heap_)
+        {
+            MessageArena::instance().deallocate(heap_);
+            heap_ = nullptr;
+            heap_capacity_ = 0;
+        }
+    }
+
+    char* heap_ = nullptr;
+    std::size_t heap_capacity_ = 0;
+    uint32_t size_ = 0;
+    char inline_[Capacity];
+};
+
+
+// Drop-in replacement for a {name, data} string message that keeps typical topics and
+// payloads inline, so publishing and per-subscriber copies don't touch the allocator.
+// Build it with the two-argument constructor to have oversized payloads counted per topic.
+template<std::size_t NameCapacity = 32, std::size_t DataCapacity = 192>
+struct BusMessage
+{
+    BusMessage() = default;
+    BusMessage(std::string_view name_, std::string_view data_):
+        name(name_),
+        data(data_, name_)
+    {
+    }
+    SmallString<NameCapacity> name;
+    SmallString<DataCapacity> data;
+};
@@ -0,0 +1,200 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <mutex>
+
+
+class CancellationState;
+
+// Intrusive hook, embedded in whatever wants to be told about a cancel, so attaching never allocates.
+class CancellationRegistration
+{
+    public:
+    CancellationRegistration() = default;
+    CancellationRegistration(const CancellationRegistration&) = delete;
+    CancellationRegistration& operator=(const CancellationRegistration&) = delete;
+
+    private:
+    friend class CancellationState;
+    void (*callback_)(void*) = nullptr;
+    void* context_ = nullptr;
+    CancellationRegistration* prev_ = nullptr;
+    CancellationRegistration* next_ = nullptr;
+    bool linked_ = false;
+};
+
+
+class CancellationState
+{
+    public:
+    CancellationState() = default;
+    CancellationState(const CancellationState&) = delete;
+    CancellationState& operator=(const CancellationState&) = delete;
+
+    ~CancellationState()
+    {
+        if (parent_)
+        {
+            parent_->remove(&parent_registration_);
+        }
+    }
+
+    bool cancelled() const
+    {
+        return cancelled_.load(std::memory_order_acquire);
+    }
+
+    // returns false when already cancelled, the callback is not run in that case
+    bool add(CancellationRegistration* registration, void (*callback)(void*), void* context)
+    {
+        std::lock_guard lk(mutex_);
+        if (cancelled_) return false;
+        registration->callback_ = callback;
+        registration->context_ = context;
+        registration->prev_ = nullptr;
+        registration->next_ = head_;
+        if (head_) head_->prev_ = registration;
+        head_ = registration;
+        registration->linked_ = true;
+        return true;
+    }
+
+    // once this returns the callback is neither running nor going to run
+    void remove(CancellationRegistration* registration)
+    {
+        std::lock_guard lk(mutex_);
+        unlink(registration);
+    }
+
+    void cancel()
+    {
+        std::lock_guard lk(mutex_);
+        if (cancelled_.exchange(true, std::memory_order_acq_rel)) return;
+        while (head_)
+        {
+            CancellationRegistration* registration = head_;
+            unlink(registration);
+            registration->callback_(registration->context_);
+        }
+    }
+
+    void link_parent(std::shared_ptr<CancellationState> parent)
+    {
+        if (!parent) return;
+        parent_ = std::move(parent);
+        if (!parent_->add(&parent_registration_, [](void* self){ static_cast<CancellationState*>(self)->cancel(); }, this))
+        {
+            cancel();
+        }
+    }
+
+    private:
+    void unlink(CancellationRegistration* registration)
+    {
+        if (!registration->linked_) return;
+        if (registration->prev_) registration->prev_->next_ = registration->next_;
+        else head_ = registration->next_;
+        if (registration->next_) registration->next_->prev_ = registration->prev_;
+        registration->prev_ = registration->next_ = nullptr;
+        registration->linked_ = false;
+    }
+
+    std::mutex mutex_;
+    std::atomic<bool> cancelled_ = false;
+    CancellationRegistration* head_ = nullptr;
+    std::shared_ptr<CancellationState> parent_;
+    CancellationRegistration parent_registration_;
+};
+
+
+class CancellationToken
+{
+    public:
+    CancellationToken() = default;
+
+    bool cancelled() const
+    {
+        return state_ && state_->cancelled();
+    }
+    explicit operator bool() const
+    {
+        return state_ != nullptr;
+    }
+
+    private:
+    friend class CancellationSource;
+    friend class CancellationBinding;
+    explicit CancellationToken(std::shared_ptr<CancellationState> state):
+        state_(std::move(state))
+    {
+    }
+    std::shared_ptr<CancellationState> state_;
+};
+
+
+// Owner side of a token. A source built from a parent token is cancelled together with the parent,
+// so cancelling the root of a request sheds every coroutine below it.
+class CancellationSource
+{
+    public:
+    CancellationSource():
+        state_(std::make_shared<CancellationState>())
+    {
+    }
+    explicit CancellationSource(const CancellationToken& parent):
+        state_(std::make_shared<CancellationState>())
+    {
+        state_->link_parent(parent.state_);
+    }
+
+    CancellationToken token() const
+    {
+        return CancellationToken(state_);
+    }
+    void cancel()
+    {
+        state_->cancel();
+    }
+    bool cancelled() const
+    {
+        return state_->cancelled();
+    }
+
+    private:
+    std::shared_ptr<CancellationState> state_;
+};
+
+
+// Ties one await to a token; callback runs at most once, on the cancelling thread.
+class CancellationBinding
+{
+    public:
+    CancellationBinding() = default;
+    CancellationBinding(const CancellationBinding&) = delete;
+    CancellationBinding& operator=(const CancellationBinding&) = delete;
+    ~CancellationBinding()
+    {
+        reset();
+    }
+
+    // returns false if the token is already cancelled
+    bool bind(const CancellationToken& token, void (*callback)(void*), void* context)
+    {
+        reset();
+        state_ = token.state_;
+        if (!state_) return true;
+        return state_->add(&registration_, callback, context);
+    }
+    void reset()
+    {
+        if (state_)
+        {
+            state_->remove(&registration_);
+            state_.reset();
+        }
+    }
+
+    private:
+    std::shared_ptr<CancellationState> state_;
+    CancellationRegistration registration_;
+};
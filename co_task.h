@@ -8,6 +8,9 @@ using std::coroutine_handle;
 using std::suspend_always;
 using std::suspend_never;
 
+class Strand;
+class CoExecutor;
+
 
 enum class CoState : uint8_t
 {
@@ -65,13 +68,68 @@ class CoTask
         //     return static_cast<U&&>(awaitable);
         // }
 
+        // StopState -> QueueResume, only one waker may win
+        bool acquire()
+        {
+            CoState expected = CoState::StopState;
+            return state_.compare_exchange_strong(expected, CoState::QueueResume);
+        }
+
+        // StopState -> NormalState, taken back by the suspending coroutine itself
+        bool reclaim()
+        {
+            CoState expected = CoState::StopState;
+            return state_.compare_exchange_strong(expected, CoState::NormalState);
+        }
+
         std::exception_ptr exception_;
         std::atomic<CoState> state_{CoState::NormalState};
-        void* await = nullptr;
+        std::atomic<void*> await{nullptr};
+        // set while await_suspend still touches the frame after publishing await, executors hold off resume until it clears
+        std::atomic<bool> suspending_{false};
+        // trace flow of the message that caused the pending resume, 0 when not tracing
+        uint64_t trace_flow_ = 0;
+        // set while the coroutine is bound to a strand; the rest is the strand's inbox link
+        Strand* strand_ = nullptr;
+        promise_type* strand_next_ = nullptr;
+        CoExecutor* strand_executor_ = nullptr;
+        uint8_t strand_priority_ = 0;
+        // worker that last resumed the coroutine, for executors in affinity mode
+        CoExecutor* affinity_executor_ = nullptr;
+        uint32_t affinity_slot_ = 0;
     };
     promise_type& promise_;
 };
 
+// Handle of the coroutine waiting on an await. The coroutine stores it while the await is
+// already reachable from wakers on other threads, so it is published release/acquire: a waker
+// that sees the handle also sees the frame behind it.
+class AtomicCoHandle
+{
+    public:
+    using handle_type = coroutine_handle<CoTask::promise_type>;
+
+    void store(handle_type handle)
+    {
+        address_.store(handle.address(), std::memory_order_release);
+    }
+    handle_type load() const
+    {
+        return handle_type::from_address(address_.load(std::memory_order_acquire));
+    }
+    CoTask::promise_type& promise() const
+    {
+        return load().promise();
+    }
+    explicit operator bool() const
+    {
+        return address_.load(std::memory_order_acquire) != nullptr;
+    }
+
+    private:
+    std::atomic<void*> address_{nullptr};
+};
+
 class StopAwait
 {
     public:
@@ -272,6 +272,24 @@ namespace moodycamel { namespace details {
  #endif // TSAN
 #endif // TSAN
 
+// Local change: TSAN does not model standalone fences, so under it the accesses a fence orders in
+// Block::is_empty/set_many_empty carry the acquire/release themselves. Other builds keep relaxed + fence.
+#define MOODYCAMEL_FENCED_LOAD std::memory_order_relaxed
+#define MOODYCAMEL_FENCED_STORE std::memory_order_relaxed
+#if defined(__SANITIZE_THREAD__)
+ #undef MOODYCAMEL_FENCED_LOAD
+ #undef MOODYCAMEL_FENCED_STORE
+ #define MOODYCAMEL_FENCED_LOAD std::memory_order_acquire
+ #define MOODYCAMEL_FENCED_STORE std::memory_order_release
+#elif defined(__has_feature)
+ #if __has_feature(thread_sanitizer)
+  #undef MOODYCAMEL_FENCED_LOAD
+  #undef MOODYCAMEL_FENCED_STORE
+  #define MOODYCAMEL_FENCED_LOAD std::memory_order_acquire
+  #define MOODYCAMEL_FENCED_STORE std::memory_order_release
+ #endif // TSAN
+#endif // TSAN
+
 // Compiler-specific likely/unlikely hints
 namespace moodycamel { namespace details {
 #if defined(__GNUC__)
@@ -1572,7 +1590,7 @@ private:
 			MOODYCAMEL_CONSTEXPR_IF (context == explicit_context && BLOCK_SIZE <= EXPLICIT_BLOCK_EMPTY_COUNTER_THRESHOLD) {
 				// Check flags
 				for (size_t i = 0; i < BLOCK_SIZE; ++i) {
-					if (!emptyFlags[i].load(std::memory_order_relaxed)) {
+					if (!emptyFlags[i].load(MOODYCAMEL_FENCED_LOAD)) {
 						return false;
 					}
 				}
@@ -1583,7 +1601,7 @@ private:
 			}
 			else {
 				// Check counter
-				if (elementsCompletelyDequeued.load(std::memory_order_relaxed) == BLOCK_SIZE) {
+				if (elementsCompletelyDequeued.load(MOODYCAMEL_FENCED_LOAD) == BLOCK_SIZE) {
 					std::atomic_thread_fence(std::memory_order_acquire);
 					return true;
 				}
@@ -1621,7 +1639,7 @@ private:
 				i = BLOCK_SIZE - 1 - static_cast<size_t>(i & static_cast<index_t>(BLOCK_SIZE - 1)) - count + 1;
 				for (size_t j = 0; j != count; ++j) {
 					assert(!emptyFlags[i + j].load(std::memory_order_relaxed));
-					emptyFlags[i + j].store(true, std::memory_order_relaxed);
+					emptyFlags[i + j].store(true, MOODYCAMEL_FENCED_STORE);
 				}
 				return false;
 			}
@@ -2436,10 +2454,11 @@ private:
 			// empty (all other remaining blocks must be completely full).
 			
 #ifdef MOODYCAMEL_CPP11_THREAD_LOCAL_SUPPORTED
-			// Unregister ourselves for thread termination notification
-			if (!this->inactive.load(std::memory_order_relaxed)) {
-				details::ThreadExitNotifier::unsubscribe(&threadExitListener);
-			}
+			// Unregister ourselves for thread termination notification. Local change: done even when
+			// inactive, since the exiting thread marks us inactive from inside ~ThreadExitNotifier's
+			// walk and still reads threadExitListener.next afterwards; taking the notifier mutex here
+			// waits that walk out before we are freed (unsubscribe returns early once chain is null).
+			details::ThreadExitNotifier::unsubscribe(&threadExitListener);
 #endif
 			
 			// Destroy all remaining elements!
@@ -46,23 +46,143 @@ CoTask test_msg6(MessageBus<TestMessage>* message_bus, CoExecutor* co_executor)
 {
     auto await = message_bus->create_message_await(co_executor, "msg2");
     uint32_t v = 0;
+    TestMessage batch[16];
     while (true) 
     {
-        TestMessage msg = co_await await;
-        std::cout << "get msg2 " << msg.data << std::endl;
-        auto i = std::stoi(msg.data);
-        assert(v+1 == i);
-        v = i;
+        auto n = co_await await.next_batch(batch, 16);
+        for (std::size_t j = 0; j < n; ++j)
+        {
+            std::cout << "get msg2 " << batch[j].data << std::endl;
+            auto i = std::stoi(batch[j].data);
+            assert(v+1 == i);
+            v = i;
+        }
     }
 }
 
-CoTask test_msg3(MessageBus<TestMessage>* message_bus, CoExecutor* co_executor)
+CoTask test_msg3(MessageBus<TestMessage>* message_bus, CoExecutor* co_executor, BlockingPool* blocking_pool)
 {
     while (true) 
     {
         TestMessage msg = co_await message_bus->create_once_message_await(co_executor, "msg3");
         std::cout << "msg3 " << msg.data << std::endl;
+        co_await offload(blocking_pool);
         std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+        co_await resume_on(co_executor);
+    }
+}
+
+CoTask test_msg8(MessageBus<TestMessage>* message_bus, CoExecutor* co_executor)
+{
+    auto await = message_bus->create_message_await(co_executor, "msg2");
+    while (true) 
+    {
+        auto once = message_bus->create_once_message_await(co_executor, "msg3");
+        auto timer = co_executor->create_timer_await(std::chrono::milliseconds(500));
+        auto index = co_await when_any(await, once, timer);
+        if (index == 0)
+        {
+            std::cout << "any msg2 " << await.take().data << std::endl;
+        }else if (index == 1)
+        {
+            std::cout << "any msg3 " << once.take().data << std::endl;
+        }else 
+        {
+            std::cout << "any timeout" << std::endl;
+        }
+    }
+}
+
+// two topics update the same state; the strand keeps their handlers from overlapping, so no lock
+CoTask test_msg9(MessageBus<TestMessage>* message_bus, CoExecutor* co_executor, Strand* strand, const char* name, uint64_t* total)
+{
+    auto await = message_bus->create_message_await(co_executor, name);
+    co_await resume_on(strand);
+    while (true)
+    {
+        TestMessage msg = co_await await;
+        *total += std::stoi(msg.data);
+    }
+}
+
+// joins late and catches up from the bus's retained msg2 history, then continues live without a gap
+CoTask test_msg10(MessageBus<TestMessage>* message_bus, CoExecutor* co_executor)
+{
+    co_await co_executor->create_timer_await(std::chrono::milliseconds(200));
+    auto await = message_bus->create_snapshot_message_await(co_executor, "msg2");
+    // only the assert reads it
+    [[maybe_unused]] int v = 0;
+    while (true)
+    {
+        TestMessage msg = co_await await;
+        auto i = std::stoi(msg.data);
+        assert(v == 0 || v+1 == i);
+        v = i;
+    }
+}
+
+// producers don't need a thread of their own: a timer paces this one, and feed_lines and
+// ingest_lines below are driven by the executor's reactor
+CoTask produce_msg3(MessageBus<TestMessage>* message_bus, CoExecutor* co_executor)
+{
+    int i = 0;
+    while (true)
+    {
+        co_await co_executor->create_timer_await(std::chrono::milliseconds(1));
+        TestMessage msg;
+        msg.name = "msg3";
+        msg.data = std::to_string(++i);
+        message_bus->push_message(std::move(msg));
+    }
+}
+
+// writes a numbered line to fd every 100ms, standing in for whatever would feed a pipe
+CoTask feed_lines(CoExecutor* co_executor, int fd)
+{
+    for (int i = 1; ; ++i)
+    {
+        co_await co_executor->create_timer_await(std::chrono::milliseconds(100));
+        std::string line = "line " + std::to_string(i) + "\n";
+        std::size_t written = 0;
+        while (written < line.size())
+        {
+            ssize_t n = co_await co_executor->async_write(fd, line.data() + written, line.size() - written);
+            if (n <= 0)
+            {
+                co_return;
+            }
+            written += n;
+        }
+    }
+}
+
+// publishes every line read from fd (a pipe or socket) on topic; fd is switched to non-blocking
+// for good, so don't hand it a descriptor shared with other processes such as stdin
+CoTask ingest_lines(MessageBus<TestMessage>* message_bus, CoExecutor* co_executor, int fd, const char* topic)
+{
+    if (!set_nonblocking(fd))
+    {
+        co_return;
+    }
+    char buffer[4096];
+    std::string pending;
+    while (true)
+    {
+        ssize_t n = co_await co_executor->async_read(fd, buffer, sizeof(buffer));
+        if (n <= 0)
+        {
+            break;
+        }
+        pending.append(buffer, n);
+        std::size_t begin = 0;
+        for (std::size_t end; (end = pending.find('\n', begin)) != std::string::npos; begin = end + 1)
+        {
+            TestMessage msg;
+            msg.name = topic;
+            msg.data = pending.substr(begin, end - begin);
+            message_bus->push_message(std::move(msg));
+        }
+        pending.erase(0, begin);
     }
 }
 
@@ -71,14 +191,44 @@ int main()
 
     auto message_bus = std::make_shared<MessageBus<TestMessage>>();
     auto co_executor = std::make_shared<CoExecutor>(3);
+    co_executor->enable_reactor();
     co_executor->start();
+    auto blocking_pool = std::make_shared<BlockingPool>(4);
+    blocking_pool->start();
+    auto slow_executor = std::make_shared<CoExecutor>(1);
+    slow_executor->start();
+    SlowSubscriberPolicy policy;
+    policy.max_backlog = 1024;
+    policy.max_handler_time = std::chrono::milliseconds(100);
+    policy.action = SlowSubscriberAction::Isolate;
+    policy.isolation_executor = slow_executor.get();
+    policy.on_slow = [](std::string_view topic, SlowSubscriberReason reason)
+    {
+        std::cout << "slow subscriber on " << topic << " reason " << static_cast<int>(reason) << std::endl;
+    };
+    message_bus->set_slow_subscriber_policy(std::move(policy));
+    message_bus->set_retention("msg2", {32, {}});
     test_msg1(message_bus.get(), co_executor.get(), 1);
     test_msg1(message_bus.get(), co_executor.get(), 2);
     test_msg1(message_bus.get(), co_executor.get(), 3);
     test_msg2(message_bus.get(), co_executor.get());
-    test_msg3(message_bus.get(), co_executor.get());
+    test_msg3(message_bus.get(), co_executor.get(), blocking_pool.get());
     test_msg6(message_bus.get(), co_executor.get());
     test_msg7(message_bus.get(), co_executor.get(), 1);
+    test_msg8(message_bus.get(), co_executor.get());
+    Strand account_strand(co_executor.get());
+    uint64_t account_total = 0;
+    test_msg9(message_bus.get(), co_executor.get(), &account_strand, "msg2", &account_total);
+    test_msg9(message_bus.get(), co_executor.get(), &account_strand, "msg3", &account_total);
+    test_msg10(message_bus.get(), co_executor.get());
+    produce_msg3(message_bus.get(), co_executor.get());
+    // a pipe of our own rather than stdin, whose O_NONBLOCK would outlive us on the terminal
+    int line_pipe[2];
+    if (pipe2(line_pipe, O_NONBLOCK | O_CLOEXEC) == 0)
+    {
+        feed_lines(co_executor.get(), line_pipe[1]);
+        ingest_lines(message_bus.get(), co_executor.get(), line_pipe[0], "msg1");
+    }
     
     std::thread t1([&]()
     {
@@ -107,19 +257,6 @@ int main()
         }
     });
 
-    std::thread t3([=]()
-    {
-        int i = 0;
-        while (true)
-        {
-            TestMessage msg;
-            msg.name = "msg3";
-            msg.data = std::to_string(++i);
-            message_bus->push_message(std::move(msg));
-            std::this_thread::sleep_for(std::chrono::milliseconds(1));
-        }
-    });
-
     //std::thread t4([=](){message_bus->run();});
     message_bus->run();
     
@@ -127,5 +264,4 @@ int main()
 
     t1.join();
     t2.join();
-    t3.join();
 }
\ No newline at end of file
@@ -0,0 +1,310 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+
+// Payload allocator for bus messages. Producers bump-allocate from a thread-local 64 KiB slab;
+// consumers (usually executor threads) free into a small thread-local batch that is applied to
+// the slab counters in one go. A slab goes back to the shared cache once its producer has moved
+// on and every allocation in it is freed. Total slabs are capped; past the cap, and for payloads
+// too large for a slab, allocations fall back to operator new.
+class MessageArena
+{
+    public:
+    struct Stats
+    {
+        uint64_t slabs = 0;             // slabs currently owned by the arena (in use or cached)
+        uint64_t cached_slabs = 0;      // empty slabs waiting for reuse
+        uint64_t heap_fallbacks = 0;    // allocations served by operator new
+        int64_t live_bytes = 0;         // payload bytes allocated and not yet freed
+    };
+
+    static MessageArena& instance()
+    {
+        static MessageArena arena;
+        return arena;
+    }
+
+    void set_limits(std::size_t max_slabs, std::size_t max_cached_slabs)
+    {
+        std::lock_guard lk(mutex_);
+        max_slabs_ = max_slabs;
+        max_cached_slabs_ = max_cached_slabs;
+    }
+
+    // topic only feeds the per-topic live byte counters, it may be empty
+    char* allocate(std::size_t size, std::string_view topic = {})
+    {
+        return allocate(size, topic_counter(topic));
+    }
+
+    // same as allocate, accounted to the topic of an existing arena buffer
+    char* allocate_like(std::size_t size, const char* sibling)
+    {
+        return allocate(size, (reinterpret_cast<const Header*>(sibling) - 1)->counter);
+    }
+
+    void deallocate(char* buffer)
+    {
+        Header* header = reinterpret_cast<Header*>(buffer) - 1;
+        header->counter->live_bytes.fetch_sub(static_cast<int64_t>(header->size), std::memory_order_relaxed);
+        live_bytes_.fetch_sub(static_cast<int64_t>(header->size), std::memory_order_relaxed);
+        if (header->slab)
+        {
+            cache().release(*this, header->slab);
+        }else
+        {
+            ::operator delete(header);
+        }
+    }
+
+    // pushes this thread's pending frees to the slabs, e.g. before a worker goes idle
+    void flush()
+    {
+        cache().flush(*this);
+    }
+
+    Stats stats()
+    {
+        Stats stats;
+        {
+            std::lock_guard lk(mutex_);
+            stats.slabs = slab_num_;
+            stats.cached_slabs = free_slabs_.size();
+        }
+        stats.heap_fallbacks = heap_fallbacks_.load(std::memory_order_relaxed);
+        stats.live_bytes = live_bytes_.load(std::memory_order_relaxed);
+        return stats;
+    }
+
+    std::vector<std::pair<std::string, int64_t>> topic_live_bytes()
+    {
+        std::vector<std::pair<std::string, int64_t>> result;
+        std::lock_guard lk(mutex_);
+        result.reserve(topics_.size());
+        for (auto& [name, counter] : topics_)
+        {
+            result.emplace_back(name, counter->live_bytes.load(std::memory_order_relaxed));
+        }
+        return result;
+    }
+
+    private:
+    static constexpr std::size_t kSlabSize = 64 * 1024;
+    static constexpr std::size_t kMaxArenaAllocation = kSlabSize / 4;
+    static constexpr std::size_t kFreeBatch = 64;
+    static constexpr std::size_t kPendingSlabs = 8;
+
+    struct TopicCounter
+    {
+        std::atomic<int64_t> live_bytes = 0;
+    };
+
+    // lives at the start of every slab; live counts allocations plus one reference held by the
+    // producer while the slab is its current one
+    struct alignas(64) Slab
+    {
+        std::atomic<uint32_t> live = 0;
+    };
+
+    struct Header
+    {
+        Slab* slab;
+        TopicCounter* counter;
+        std::size_t size;
+        std::size_t reserved;
+    };
+
+    class ThreadCache
+    {
+        public:
+        ~ThreadCache()
+        {
+            MessageArena& arena = MessageArena::instance();
+            flush(arena);
+            if (current_)
+            {
+                arena.drop_reference(current_, 1);
+            }
+        }
+
+        Header* bump(MessageArena& arena, std::size_t total)
+        {
+            if (!current_ || cursor_ + total > end_)
+            {
+                if (current_)
+                {
+                    arena.drop_reference(current_, 1);
+                }
+                current_ = arena.acquire_slab();
+                if (!current_)
+                {
+                    return nullptr;
+                }
+                current_->live.store(1, std::memory_order_relaxed);
+                cursor_ = reinterpret_cast<char*>(current_) + sizeof(Slab);
+                end_ = reinterpret_cast<char*>(current_) + kSlabSize;
+            }
+            auto header = reinterpret_cast<Header*>(cursor_);
+            cursor_ += total;
+            current_->live.fetch_add(1, std::memory_order_relaxed);
+            return header;
+        }
+
+        void release(MessageArena& arena, Slab* slab)
+        {
+            for (std::size_t i = 0; i < pending_num_; ++i)
+            {
+                if (pending_[i].first == slab)
+                {
+                    if (++pending_[i].second >= kFreeBatch)
+                    {
+                        arena.drop_reference(slab, pending_[i].second);
+                        pending_[i] = pending_[--pending_num_];
+                    }
+                    return;
+                }
+            }
+            if (pending_num_ == kPendingSlabs)
+            {
+                flush(arena);
+            }
+            pending_[pending_num_++] = {slab, 1};
+        }
+
+        void flush(MessageArena& arena)
+        {
+            for (std::size_t i = 0; i < pending_num_; ++i)
+            {
+                arena.drop_reference(pending_[i].first, pending_[i].second);
+            }
+            pending_num_ = 0;
+        }
+
+        private:
+        Slab* current_ = nullptr;
+        char* cursor_ = nullptr;
+        char* end_ = nullptr;
+        std::pair<Slab*, uint32_t> pending_[kPendingSlabs];
+        std::size_t pending_num_ = 0;
+    };
+
+    MessageArena() = default;
+    ~MessageArena()
+    {
+        for (Slab* slab : free_slabs_)
+        {
+            ::operator delete(slab, std::align_val_t(kSlabSize));
+        }
+    }
+
+    static ThreadCache& cache()
+    {
+        static thread_local ThreadCache cache;
+        return cache;
+    }
+
+    static std::size_t align(std::size_t size)
+    {
+        return (size + alignof(Header) - 1) & ~(alignof(Header) - 1);
+    }
+
+    static Slab* slab_of(Header* header)
+    {
+        return reinterpret_cast<Slab*>(reinterpret_cast<uintptr_t>(header) & ~(kSlabSize - 1));
+    }
+
+    char* allocate(std::size_t size, TopicCounter* counter)
+    {
+        std::size_t total = align(sizeof(Header) + size);
+        Header* header = nullptr;
+        if (total <= kMaxArenaAllocation)
+        {
+            header = cache().bump(*this, total);
+        }
+        if (header)
+        {
+            header->slab = slab_of(header);
+        }else
+        {
+            header = static_cast<Header*>(::operator new(sizeof(Header) + size));
+            header->slab = nullptr;
+            heap_fallbacks_.fetch_add(1, std::memory_order_relaxed);
+        }
+        header->size = size;
+        header->counter = counter;
+        counter->live_bytes.fetch_add(static_cast<int64_t>(size), std::memory_order_relaxed);
+        live_bytes_.fetch_add(static_cast<int64_t>(size), std::memory_order_relaxed);
+        return reinterpret_cast<char*>(header + 1);
+    }
+
+    Slab* acquire_slab()
+    {
+        std::lock_guard lk(mutex_);
+        if (!free_slabs_.empty())
+        {
+            Slab* slab = free_slabs_.back();
+            free_slabs_.pop_back();
+            return slab;
+        }
+        if (slab_num_ >= max_slabs_)
+        {
+            return nullptr;
+        }
+        ++slab_num_;
+        return new (::operator new(kSlabSize, std::align_val_t(kSlabSize))) Slab;
+    }
+
+    void drop_reference(Slab* slab, uint32_t count)
+    {
+        if (slab->live.fetch_sub(count, std::memory_order_acq_rel) != count)
+        {
+            return;
+        }
+        std::lock_guard lk(mutex_);
+        if (free_slabs_.size() < max_cached_slabs_)
+        {
+            free_slabs_.push_back(slab);
+            return;
+        }
+        --slab_num_;
+        ::operator delete(slab, std::align_val_t(kSlabSize));
+    }
+
+    TopicCounter* topic_counter(std::string_view topic)
+    {
+        static thread_local std::string last_topic;
+        static thread_local TopicCounter* last_counter = nullptr;
+        if (last_counter && last_topic == topic)
+        {
+            return last_counter;
+        }
+        std::lock_guard lk(mutex_);
+        auto it = topics_.find(std::string(topic));
+        if (it == topics_.end())
+        {
+            it = topics_.emplace(std::string(topic), std::make_unique<TopicCounter>()).first;
+        }
+        last_topic = topic;
+        last_counter = it->second.get();
+        return last_counter;
+    }
+
+    std::mutex mutex_;
+    std::vector<Slab*> free_slabs_;
+    std::size_t slab_num_ = 0;
+    std::size_t max_slabs_ = 1024;
+    std::size_t max_cached_slabs_ = 64;
+    std::unordered_map<std::string, std::unique_ptr<TopicCounter>> topics_;
+    std::atomic<uint64_t> heap_fallbacks_ = 0;
+    std::atomic<int64_t> live_bytes_ = 0;
+};
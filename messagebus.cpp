@@ -15,29 +15,35 @@ SharedMessageAwait<T>::SharedMessageAwait(MessageBus<T>* message_bus, CoExecutor
     {
         queue_ = std::make_shared<moodycamel::ConcurrentQueue<T>>();
     }
-    iter_ = message_bus_->add_await(this);
+    message_bus_->add_await(this);
 }
 
 template<typename T>
 SharedMessageAwait<T>::~SharedMessageAwait()
 {
-    message_bus_->template remove_await<SharedMessageAwait<T>>(iter_);
+    cancel_binding_.reset();
+    detach();
 }
 
 
 template<typename T>
-MessageAwait<T>::MessageAwait(MessageBus<T>* message_bus, CoExecutor* co_executor, const std::string& wait_message_name):
+MessageAwait<T>::MessageAwait(MessageBus<T>* message_bus, CoExecutor* co_executor, const std::string& wait_message_name, bool snapshot):
     message_bus_(message_bus),
     co_executor_(co_executor),
     wait_message_name_(wait_message_name)
 {
-    iter_ = message_bus_->add_await(this);
+    message_bus_->add_await(this);
+    if (snapshot)
+    {
+        message_bus_->replay_retained(this);
+    }
 }
 
 template<typename T>
 MessageAwait<T>::~MessageAwait()
 {
-    message_bus_-> template remove_await<MessageAwait<T>>(iter_);
+    cancel_binding_.reset();
+    detach();
 }
 
 
@@ -47,16 +53,25 @@ OnceMessageAwait<T>::OnceMessageAwait(MessageBus<T>* message_bus, CoExecutor* co
     co_executor_(co_executor),
     wait_message_name_(wait_message_name)
 {
-    iter_ = message_bus_->add_await(this);
+    message_bus_->add_await(this);
 }
 
 template<typename T>
 OnceMessageAwait<T>::~OnceMessageAwait()
 {
-    message_bus_-> template remove_await<OnceMessageAwait<T>>(iter_);
+    cancel_binding_.reset();
+    detach();
 }
 
 
 template class SharedMessageAwait<TestMessage>;
 template class MessageAwait<TestMessage>;
 template class OnceMessageAwait<TestMessage>;
+
+template class SharedMessageAwait<BusMessage<>>;
+template class MessageAwait<BusMessage<>>;
+template class OnceMessageAwait<BusMessage<>>;
+
+template class SharedMessageAwait<WireMessage>;
+template class MessageAwait<WireMessage>;
+template class OnceMessageAwait<WireMessage>;
@@ -8,386 +8,2688 @@
 #include <unordered_map>
 #include <memory>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <thread>
-#include <list>
 #include <optional>
 #include <queue>
+#include <map>
+#include <chrono>
+#include <tuple>
+#include <functional>
+#include <algorithm>
+#include <utility>
 #include <iostream>
+#include <cassert>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
 #include "concurrentqueue.h"
+#include "mpsc_ring.h"
+#include "spsc_ring.h"
+#include "topic_routes.h"
 #include "co_task.h"
+#include "cancellation.h"
+#include "bus_message.h"
+#include "wire_format.h"
+#include "trace.h"
 
 using std::coroutine_handle;
 
-using CoHandleWithPriority = std::pair<coroutine_handle<CoTask::promise_type>, uint8_t>;
+struct CoHandleWithPriority
+{
+    coroutine_handle<CoTask::promise_type> handle;
+    uint8_t priority = 0;
+    std::chrono::steady_clock::time_point enqueue_time;
+};
 template<>
 struct std::less<CoHandleWithPriority>
 {
     bool operator()( const CoHandleWithPriority& lhs, const CoHandleWithPriority& rhs ) const
     {
-        return lhs.second < rhs.second;
+        return lhs.priority < rhs.priority;
     }
 };
 
 
+struct DrainReport
+{
+    std::size_t dropped = 0;    // messages, or coroutines, left behind at the deadline (see each drain)
+    bool completed = true;      // false if the deadline expired first
+};
+
+struct ExecutorWorkerStats
+{
+    uint64_t resumes = 0;
+    uint64_t rejected_resumes = 0;  // resume_coroutine calls refused, the coroutine wasn't in StopState
+    uint64_t wakeups = 0;           // returns from an idle wait
+    uint64_t steals = 0;            // resumes taken from another worker; 0 while there is one shared queue
+    uint64_t idle_ns = 0;
+    uint64_t busy_ns = 0;
+    uint64_t wait_ns = 0;           // summed enqueue-to-pop time of the resumes this worker ran
+};
+
+struct ExecutorStats
+{
+    std::size_t queue_depth = 0;
+    uint64_t last_wait_ns = 0;
+    // one entry per worker slot; the last one counts calls made from threads outside the pool
+    std::vector<ExecutorWorkerStats> workers;
+};
+
+class TimerAwait;
+class IoAwait;
+
 class CoExecutor
 {
     public:
-    CoExecutor(int thread_num):thread_num_(thread_num)
+    CoExecutor(int thread_num):thread_num_(thread_num), max_thread_num_(thread_num)
+    {
+        init_counters();
+    }
+    // Elastic pool: starts min_thread_num workers, adds one (up to max_thread_num) when resumes
+    // keep waiting longer than target_wait or the backlog outgrows the pool, and retires workers
+    // that sat idle for idle_timeout. Growth is rate limited and retirement needs a full idle
+    // period after the last resize, so a bursty load doesn't make the pool flap.
+    CoExecutor(int min_thread_num, int max_thread_num, std::chrono::microseconds target_wait,
+        std::chrono::milliseconds idle_timeout = std::chrono::milliseconds(1000)):
+        thread_num_(min_thread_num),
+        max_thread_num_(max_thread_num),
+        target_wait_(target_wait),
+        idle_timeout_(idle_timeout)
+    {
+        init_counters();
+    }
+    // Affinity mode, set before start(): a coroutine is queued on the worker that last ran it so
+    // its frame and data stay in that core's cache. Idle workers steal only when a worker's own
+    // queue backs up or its head has waited longer than kStealAge.
+    void set_affinity(bool affinity)
     {
+        affinity_ = affinity;
     }
+    // Reactor mode, set before start(): one idle worker at a time waits in epoll instead of on a
+    // condition variable and is woken through an eventfd, so coroutines can co_await sockets and
+    // pipes (async_read, async_accept, ...) without a thread blocked on each. Returns false if
+    // epoll or eventfd is unavailable; the executor then keeps working without it.
+    bool enable_reactor()
+    {
+        epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+        event_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.fd = event_fd_;
+        if (epoll_fd_ < 0 || event_fd_ < 0 || epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, event_fd_, &ev) < 0)
+        {
+            if (epoll_fd_ >= 0) close(epoll_fd_);
+            if (event_fd_ >= 0) close(event_fd_);
+            epoll_fd_ = event_fd_ = -1;
+            return false;
+        }
+        return true;
+    }
+
     void start()
     {
         if (thread_num_ < 1) thread_num_ = 1;
-        thread_pool_.reserve(thread_num_);
+        if (max_thread_num_ < thread_num_) max_thread_num_ = thread_num_;
+        std::lock_guard lk(mutex_);
+        thread_pool_.reserve(max_thread_num_);
+        last_resize_ = std::chrono::steady_clock::now();
         for (int i = 0; i < thread_num_; ++i)
         {
-            thread_pool_.emplace_back([this]()
-            {
-                loop_resume_coroutine();
-            });
+            spawn_worker();
         }
     }
 
     void stop()
     {
+        std::lock_guard lk(mutex_);
+        stop_ = true;
+        wake_all();
+    }
+
+    // Runs every queued resume, then lets the workers exit; workers are joined before this
+    // returns. dropped counts the coroutines this executor will never resume: queued resumes
+    // (dropped from the queues when timeout expires), those parked on a strand behind a dropped
+    // one, timer waiters yet to fire and I/O waiters (those stay registered, their awaits own them).
+    DrainReport drain(std::chrono::steady_clock::duration timeout)
+    {
+        DrainReport report;
+        std::unique_lock lk(mutex_);
+        draining_ = true;
+        wake_all();
+        if (!cv_.wait_for(lk, timeout, [this](){return alive_thread_num_ == 0;}))
         {
-            std::lock_guard lk(mutex_);
+            report.completed = false;
             stop_ = true;
+            wake_all();
         }
-        cv_.notify_all();
+        lk.unlock();
+        for (auto& t : thread_pool_)
+        {
+            if (t.joinable()) t.join();
+        }
+        lk.lock();
+        report.dropped = drop_queue(queue_);
+        for (std::size_t i = 0; i + 1 < counter_num_; ++i)
+        {
+            report.dropped += drop_queue(worker_queues_[i].queue);
+        }
+        local_num_ = 0;
+        report.dropped += strand_fired_.size() + timers_.size();
+        strand_fired_.clear();
+        for (auto& [fd, watch] : io_watches_)
+        {
+            report.dropped += (watch.reader ? 1 : 0) + (watch.writer ? 1 : 0);
+        }
+        queue_depth_.store(0, std::memory_order_relaxed);
+        return report;
     }
 
     ~CoExecutor()
     {
         for (auto& t : thread_pool_)
         {
-            t.join();
+            if (t.joinable()) t.join();
+        }
+        if (epoll_fd_ >= 0)
+        {
+            close(epoll_fd_);
+            close(event_fd_);
         }
     }
 
     bool resume_coroutine(const coroutine_handle<CoTask::promise_type>& handle, uint8_t priority = 0)
     {
-         if (handle.promise().state_ == CoState::StopState)
-         {
-            handle.promise().state_ = CoState::QueueResume;
-            {
-                std::lock_guard lk(mutex_);
-                queue_.push({handle, priority});
-                if (wait_thread_num > 0)
-                {
-                    cv_.notify_one();
-                }
-            }
-            return true;
-         }else 
-         {
-            return false;
-         }
-    }
-
-    private:
-    void loop_resume_coroutine()
-    {
-        CoHandleWithPriority co_handle;
-        while (true)
+        if (!handle.promise().acquire())
         {
-            std::unique_lock lk(mutex_);
-            ++wait_thread_num;
-            cv_.wait(lk, [this](){return queue_.size() > 0 || stop_;});
-            --wait_thread_num;
-            if (stop_)
-            {
-                lk.unlock();
-                return;
-            }
-            co_handle = queue_.top();
-            queue_.pop();
-            lk.unlock();
-            co_handle.first.resume();
+            local_counters().rejected_resumes.fetch_add(1, std::memory_order_relaxed);
+            return false;
         }
+        schedule_coroutine(handle, priority);
+        return true;
     }
-    private:
-    std::priority_queue<CoHandleWithPriority> queue_;
-    std::vector<std::thread> thread_pool_;
-    int thread_num_;
-    std::mutex mutex_;
-    std::condition_variable cv_;
-    uint16_t wait_thread_num = 0;
-    bool stop_ = false;
-};
 
+    // handle must already be acquired (state_ == QueueResume)
+    void schedule_coroutine(const coroutine_handle<CoTask::promise_type>& handle, uint8_t priority = 0);
 
-template<typename T>
-class MessageBus;
+    TimerAwait create_timer_await(std::chrono::steady_clock::duration timeout);
 
-template<typename T>
-class SharedMessageAwait
-{
-    public:
-    bool await_ready()
-    {
-        return queue_->try_dequeue(data_);
-    }
-    void await_suspend(coroutine_handle<CoTask::promise_type> handle)
-    {
-        handle_ = handle;
-        handle_.promise().state_ = CoState::StopState;
-        handle_.promise().await = this;
-    }
+    // I/O awaits, they need enable_reactor() and a non-blocking fd (see set_nonblocking)
+    IoAwait wait_readable(int fd);
+    IoAwait wait_writable(int fd);
+    IoAwait async_read(int fd, void* buffer, std::size_t size);
+    IoAwait async_write(int fd, const void* data, std::size_t size);
+    IoAwait async_accept(int listen_fd);
 
-    T&& await_resume()
-    { 
-        handle_.promise().state_ = CoState::NormalState;
-        return std::move(data_);
-    }
-    ~SharedMessageAwait();
-    private:
-    using IterType = typename std::list<SharedMessageAwait<T>*>::const_iterator;
-    SharedMessageAwait(MessageBus<T>* message_bus, CoExecutor* co_executor, const std::string& wait_message_name, 
-        std::shared_ptr<moodycamel::ConcurrentQueue<T>> queue = nullptr);
-    SharedMessageAwait<T> clone()
+    int thread_num()
     {
-        return {message_bus_, co_executor_, wait_message_name_, queue_};
+        std::lock_guard lk(mutex_);
+        return alive_thread_num_;
     }
 
-    bool push_message(T data)
+    // false once stop() or drain() was called; a resume scheduled after that may never run
+    bool running()
     {
-        return queue_->enqueue(std::move(data));
+        std::lock_guard lk(mutex_);
+        return !stop_ && !draining_;
     }
-    bool resume_one_coroutine(const T& data)
+
+    // Lock-free snapshot; counters are relaxed, so fields may be a few events apart.
+    ExecutorStats stats() const
     {
-        if (!handle_ || handle_.promise().await != this)
-        {
-            return false;
-        }
-        bool r = co_executor_->resume_coroutine(handle_);
-        if (r)
+        ExecutorStats stats;
+        stats.queue_depth = queue_depth_.load(std::memory_order_relaxed);
+        stats.last_wait_ns = last_wait_ns_.load(std::memory_order_relaxed);
+        stats.workers.reserve(counter_num_);
+        for (std::size_t i = 0; i < counter_num_; ++i)
         {
-            data_ = data;
+            const WorkerCounters& c = counters_[i];
+            ExecutorWorkerStats& w = stats.workers.emplace_back();
+            w.resumes = c.resumes.load(std::memory_order_relaxed);
+            w.rejected_resumes = c.rejected_resumes.load(std::memory_order_relaxed);
+            w.wakeups = c.wakeups.load(std::memory_order_relaxed);
+            w.steals = c.steals.load(std::memory_order_relaxed);
+            w.idle_ns = c.idle_ns.load(std::memory_order_relaxed);
+            w.busy_ns = c.busy_ns.load(std::memory_order_relaxed);
+            w.wait_ns = c.wait_ns.load(std::memory_order_relaxed);
         }
-        return r;
-    }
-    friend class MessageBus<T>;
-    std::string wait_message_name_;
-    std::shared_ptr<moodycamel::ConcurrentQueue<T>> queue_;
-    MessageBus<T>* message_bus_ = nullptr;
-    CoExecutor* co_executor_ = nullptr;
-    coroutine_handle<CoTask::promise_type> handle_;
-    bool suspend_ = false;
-    T data_;
-    IterType iter_;
-};
-template<typename T>
-class MessageAwait
-{
-    public:
-    bool await_ready()
-    {
-        return queue_.try_dequeue(data_);
+        return stats;
     }
-    void await_suspend(coroutine_handle<CoTask::promise_type> handle)
+
+    private:
+    // one cache line per worker so counting never bounces lines between workers
+    struct alignas(64) WorkerCounters
     {
-        suspend_ = true;
-        handle_ = handle;
-        handle_.promise().state_ = CoState::StopState;
-        handle_.promise().await = this;
-    }
+        std::atomic<uint64_t> resumes{0};
+        std::atomic<uint64_t> rejected_resumes{0};
+        std::atomic<uint64_t> wakeups{0};
+        std::atomic<uint64_t> steals{0};
+        std::atomic<uint64_t> idle_ns{0};
+        std::atomic<uint64_t> busy_ns{0};
+        std::atomic<uint64_t> wait_ns{0};
+    };
 
-    T&& await_resume()
+    // the worker slot of the calling thread, or the shared slot for threads outside the pool
+    static inline thread_local const CoExecutor* current_executor_ = nullptr;
+    static inline thread_local WorkerCounters* current_counters_ = nullptr;
+
+    void init_counters()
     {
-        if (suspend_)
-        {
-            queue_.try_dequeue(data_);
-        }   
-        suspend_ = false;
-        handle_.promise().state_ = CoState::NormalState;
-        return std::move(data_);
+        counter_num_ = static_cast<std::size_t>(std::max({thread_num_, max_thread_num_, 1})) + 1;
+        counters_ = std::make_unique<WorkerCounters[]>(counter_num_);
+        worker_queues_ = std::make_unique<WorkerQueue[]>(counter_num_ - 1);
+        slot_used_.assign(counter_num_ - 1, false);
     }
 
-    ~MessageAwait();
-    private:
-    using IterType = typename std::list<MessageAwait<T>*>::const_iterator;
-    
-    MessageAwait(MessageBus<T>* message_bus, CoExecutor* co_executor, const std::string& wait_message_name);
-
-    bool push_message(T data)
+    WorkerCounters& local_counters()
     {
-        if (!handle_) return false;
-        bool r = queue_.enqueue(std::move(data));
-        if (handle_.promise().await == this)
+        if (current_executor_ == this)
         {
-            co_executor_->resume_coroutine(handle_);
+            return *current_counters_;
         }
-        return r;
+        return counters_[counter_num_ - 1];
     }
-    friend class MessageBus<T>;
-    std::string wait_message_name_;
-    moodycamel::ConcurrentQueue<T> queue_;
-    MessageBus<T>* message_bus_ = nullptr;
-    CoExecutor* co_executor_ = nullptr;
-    coroutine_handle<CoTask::promise_type> handle_;
-    bool suspend_ = false;
-    T data_;
-    IterType iter_;
-};
-template<typename T>
-class OnceMessageAwait
-{
-    public:
-    bool await_ready()
+
+    static uint64_t elapsed_ns(std::chrono::steady_clock::time_point from, std::chrono::steady_clock::time_point to)
     {
-        return false;
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(to - from).count();
     }
-    void await_suspend(coroutine_handle<CoTask::promise_type> handle)
+
+    using TimerMap = std::multimap<std::chrono::steady_clock::time_point, TimerAwait*>;
+    friend class TimerAwait;
+    friend class IoAwait;
+    friend class SimExecutor;
+
+    // timer clock; virtual under SimExecutor
+    std::chrono::steady_clock::time_point clock_now() const
     {
-        handle_ = handle;
-        handle_.promise().state_ = CoState::StopState;
-        handle_.promise().await = this;
+        return simulated_ ? sim_now_ : std::chrono::steady_clock::now();
     }
 
-    T&& await_resume()
+    // at most one reader and one writer per fd; the fd stays in epoll while it is used
+    struct IoWatch
     {
-        handle_.promise().state_ = CoState::NormalState;
-        return std::move(data_);
-    }
-    ~OnceMessageAwait();
-    private:
-    using IterType = typename std::list<OnceMessageAwait<T>*>::const_iterator;
-    OnceMessageAwait(MessageBus<T>* message_bus, CoExecutor* co_executor, const std::string& wait_message_name);
+        IoAwait* reader = nullptr;
+        IoAwait* writer = nullptr;
+        bool registered = false;
+    };
+    friend class Strand;
 
-    bool push_message(T data)
+    // the queue push behind schedule_coroutine, after strand routing
+    void push_ready(const coroutine_handle<CoTask::promise_type>& handle, uint8_t priority)
     {
-        if (!handle_) return false;
-        data_ = std::move(data);
-        if (handle_.promise().await == this)
+        if (simulated_)
         {
-            co_executor_->resume_coroutine(handle_);
+            sim_ready_.push_back(handle);
+            return;
         }
-        return true;
-    }
-    friend class MessageBus<T>;
-    std::string wait_message_name_;
-    MessageBus<T>* message_bus_ = nullptr;
-    CoExecutor* co_executor_ = nullptr;
-    coroutine_handle<CoTask::promise_type> handle_;
-    T data_;
-    IterType iter_;
-};
-
-
-enum class AwaitType : uint8_t
-{
-    Invalid = 0,
-    Shared = 1,
-    Once = 2,
-    Normal = 3,
-};
-
-template<typename T>
-struct AwaitTypeTraits
-{
-    const static AwaitType value = AwaitType::Invalid;
-};
-
-
-template<typename T>
-struct AwaitTypeTraits<SharedMessageAwait<T>>
-{
-    const static AwaitType value = AwaitType::Shared;
-};
-template<typename T>
-struct AwaitTypeTraits<MessageAwait<T>>
-{
-    const static AwaitType value = AwaitType::Normal;
-};
-template<typename T>
-struct AwaitTypeTraits<OnceMessageAwait<T>>
-{
-    const static AwaitType value = AwaitType::Once;
-};
-
-
-template<typename T>
-class MessageBus
-{   
-    public:
-    MessageBus() = default;
-    ~MessageBus() = default;
-    MessageBus(const MessageBus&) = delete;
-    MessageBus& operator=(const MessageBus&) = delete;
-
-    SharedMessageAwait<T> create_shared_message_await(CoExecutor* co_executor, const std::string& wait_message_name)
-    {
-        std::unique_lock lk(shared_message_await_map_mutex_);
-        auto it = shared_message_await_map_.find(wait_message_name);
-        if (it != shared_message_await_map_.end() && it->second.size() > 0)
+        auto now = std::chrono::steady_clock::now();
+        if (Tracer::enabled() && Tracer::current_flow())
         {
-            return it->second.front()->clone();
+            handle.promise().trace_flow_ = Tracer::current_flow();
+            Tracer::instance().record(TraceKind::ResumeEnqueued, Tracer::current_flow());
         }
-        return {this, co_executor, wait_message_name};
-    }
-    MessageAwait<T> create_message_await(CoExecutor* co_executor, const std::string& wait_message_name)
-    {
-        std::unique_lock lk(message_await_map_mutex_);
-        return {this, co_executor, wait_message_name};
-    }
-    OnceMessageAwait<T> create_once_message_await(CoExecutor* co_executor, const std::string& wait_message_name)
-    {
-        std::unique_lock lk(once_message_await_map_mutex_);
-        return {this, co_executor, wait_message_name};
+        std::lock_guard lk(mutex_);
+        auto& promise = handle.promise();
+        if (affinity_ && promise.affinity_executor_ == this && worker_queues_[promise.affinity_slot_].alive)
+        {
+            WorkerQueue& worker = worker_queues_[promise.affinity_slot_];
+            worker.queue.push({handle, priority, now});
+            ++local_num_;
+            if (worker.idle)
+            {
+                worker.idle = false;
+                worker.cv.notify_one();
+            }else if (polling_ && poll_slot_ == promise.affinity_slot_)
+            {
+                kick_poller();
+            }else if (steal_waiters_ == 0)
+            {
+                // owner is busy; get an idle worker watching in case the backlog needs stealing
+                wake_one();
+            }
+        }else 
+        {
+            queue_.push({handle, priority, now});
+            wake_one();
+        }
+        queue_depth_.store(queue_.size() + local_num_, std::memory_order_relaxed);
     }
 
-    template<typename Await>
-    typename Await::IterType add_await(Await* await)
+    // Wakers below are called with mutex_ held. In affinity mode every worker sleeps on its own
+    // condition variable, so a targeted push wakes exactly the owner; cv_ then only serves drain.
+    // The worker waiting in epoll isn't counted in wait_thread_num, it is reached through the eventfd.
+    void wake_one()
     {
-        if constexpr (AwaitTypeTraits<Await>::value == AwaitType::Shared)
+        if (wait_thread_num == 0)
         {
-            shared_message_await_map_[await->wait_message_name_].push_back(await);
-            return --shared_message_await_map_[await->wait_message_name_].end();
+            kick_poller();
+            return;
         }
-        else if constexpr (AwaitTypeTraits<Await>::value == AwaitType::Normal)
+        if (!affinity_)
         {
-            message_await_map_[await->wait_message_name_].push_back(await);
-            return --message_await_map_[await->wait_message_name_].end();
+            cv_.notify_one();
+            return;
         }
-        else if constexpr (AwaitTypeTraits<Await>::value == AwaitType::Once)
+        for (std::size_t i = 0; i + 1 < counter_num_; ++i)
         {
-            once_message_await_map_[await->wait_message_name_].push_back(await);
-            return --once_message_await_map_[await->wait_message_name_].end();
+            if (worker_queues_[i].idle)
+            {
+                worker_queues_[i].idle = false;
+                worker_queues_[i].cv.notify_one();
+                return;
+            }
         }
-        assert(false);
-        return {};
     }
-    template<typename Await>
-    void remove_await(typename Await::IterType iter)
+    void wake_all()
     {
-        if constexpr (AwaitTypeTraits<Await>::value == AwaitType::Shared)
-        {
-            std::unique_lock lk(shared_message_await_map_mutex_);
-            shared_message_await_map_[(*iter)->wait_message_name_].erase(iter);
-        }
-        else if constexpr (AwaitTypeTraits<Await>::value == AwaitType::Normal)
-        {
-            std::unique_lock lk(message_await_map_mutex_);
-            message_await_map_[(*iter)->wait_message_name_].erase(iter);
-        }
-        else if constexpr (AwaitTypeTraits<Await>::value == AwaitType::Once)
+        kick_poller();
+        cv_.notify_all();
+        if (affinity_)
         {
-            std::unique_lock lk(once_message_await_map_mutex_);
-            once_message_await_map_[(*iter)->wait_message_name_].erase(iter);
+            for (std::size_t i = 0; i + 1 < counter_num_; ++i)
+            {
+                worker_queues_[i].idle = false;
+                worker_queues_[i].cv.notify_all();
+            }
         }
-        return;
     }
 
-    bool push_message(T&& data)
+    // called with mutex_ held; own queue and the shared queue by priority, then a steal
+    bool take(std::size_t slot, CoHandleWithPriority& co_handle, WorkerCounters& counters)
     {
-        bool r = queue_.enqueue(std::move(data));
-        if (suspend_co_num_ > 0 && r)
+        WorkerQueue& own = worker_queues_[slot];
+        if (!own.queue.empty() && (queue_.empty() || !(own.queue.top().priority < queue_.top().priority)))
         {
-            cv_.notify_one();
+            co_handle = own.queue.top();
+            own.queue.pop();
+            --local_num_;
+            return true;
+        }
+        if (!queue_.empty())
+        {
+            co_handle = queue_.top();
+            queue_.pop();
+            return true;
+        }
+        if (local_num_ == 0)
+        {
+            return false;
+        }
+        WorkerQueue* victim = nullptr;
+        for (std::size_t i = 0; i + 1 < counter_num_; ++i)
+        {
+            if (i != slot && (!victim || worker_queues_[i].queue.size() > victim->queue.size()))
+            {
+                victim = &worker_queues_[i];
+            }
+        }
+        if (!victim || victim->queue.empty() || (victim->queue.size() <= kStealBacklog && 
+            std::chrono::steady_clock::now() - victim->queue.top().enqueue_time < kStealAge))
+        {
+            return false;
+        }
+        co_handle = victim->queue.top();
+        victim->queue.pop();
+        --local_num_;
+        counters.steals.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    void add_timer(TimerAwait* timer);
+    void cancel_timer(TimerAwait* timer);
+    void fire_timers(std::chrono::steady_clock::time_point now);
+
+    void kick_poller()
+    {
+        if (polling_ && !kicked_)
+        {
+            kicked_ = true;
+            uint64_t one = 1;
+            [[maybe_unused]] auto r = write(event_fd_, &one, sizeof(one));
+        }
+    }
+    bool watch_io(IoAwait* io);
+    void unwatch_io(IoAwait* io);
+    bool arm_io(int fd, IoWatch& watch);
+    void fire_io(const epoll_event* events, int n);
+    void fire_io_await(IoAwait* io, uint32_t ready);
+
+    // Called with mutex_ held by an idle worker that took the poller role; waits in epoll until
+    // I/O, a kick or the next deadline. Returns true if the worker should retire.
+    bool poll_io(std::unique_lock<std::mutex>& lk, std::size_t slot, bool watch, WorkerCounters& counters)
+    {
+        auto idle_start = std::chrono::steady_clock::now();
+        auto idle_deadline = idle_start + idle_timeout_;
+        std::optional<std::chrono::steady_clock::time_point> deadline;
+        if (elastic())
+        {
+            deadline = idle_deadline;
+        }
+        if (!timers_.empty() && (!deadline || timers_.begin()->first < *deadline))
+        {
+            deadline = timers_.begin()->first;
+        }
+        if (watch && (!deadline || idle_start + kStealAge < *deadline))
+        {
+            deadline = idle_start + kStealAge;
+        }
+        int timeout = -1;
+        if (deadline)
+        {
+            // round up, waking a little late beats spinning on a sub-millisecond remainder
+            auto remaining = std::chrono::ceil<std::chrono::milliseconds>(*deadline - idle_start).count();
+            timeout = static_cast<int>(std::clamp<decltype(remaining)>(remaining, 0, INT32_MAX));
+        }
+        polling_ = true;
+        poll_slot_ = slot;
+        steal_waiters_ += watch;
+        lk.unlock();
+        epoll_event events[kIoBatch];
+        int n = epoll_wait(epoll_fd_, events, kIoBatch, timeout);
+        lk.lock();
+        polling_ = false;
+        steal_waiters_ -= watch;
+        auto now = std::chrono::steady_clock::now();
+        counters.wakeups.fetch_add(1, std::memory_order_relaxed);
+        counters.idle_ns.fetch_add(elapsed_ns(idle_start, now), std::memory_order_relaxed);
+        if (n > 0)
+        {
+            fire_io(events, n);
+            return false;
+        }
+        return n == 0 && elastic() && deadline == idle_deadline && queue_.empty() && 
+            worker_queues_[slot].queue.empty() && should_retire(now);
+    }
+
+    void release_strand(Strand* strand);
+    // empties a ready queue, returns how many coroutines that leaves unresumed
+    static std::size_t drop_queue(std::priority_queue<CoHandleWithPriority>& queue);
+
+    bool elastic() const
+    {
+        return max_thread_num_ > thread_num_;
+    }
+
+    // called with mutex_ held
+    void spawn_worker()
+    {
+        for (auto id : exited_)
+        {
+            for (auto it = thread_pool_.begin(); it != thread_pool_.end(); ++it)
+            {
+                if (it->get_id() == id)
+                {
+                    it->join();
+                    thread_pool_.erase(it);
+                    break;
+                }
+            }
+        }
+        exited_.clear();
+        std::size_t slot = 0;
+        while (slot_used_[slot]) ++slot;
+        slot_used_[slot] = true;
+        worker_queues_[slot].alive = true;
+        ++alive_thread_num_;
+        thread_pool_.emplace_back([this, slot]()
+        {
+            current_executor_ = this;
+            current_counters_ = &counters_[slot];
+            loop_resume_coroutine(slot);
+            current_executor_ = nullptr;
+            current_counters_ = nullptr;
+            std::lock_guard lk(mutex_);
+            slot_used_[slot] = false;
+            // whatever was still pinned to this worker goes back to the shared queue
+            WorkerQueue& own = worker_queues_[slot];
+            own.alive = false;
+            own.idle = false;
+            while (!own.queue.empty())
+            {
+                queue_.push(own.queue.top());
+                own.queue.pop();
+                --local_num_;
+                wake_one();
+            }
+            --alive_thread_num_;
+            exited_.push_back(std::this_thread::get_id());
+            cv_.notify_all();
+        });
+    }
+
+    // called with mutex_ held after every pop
+    void adjust_thread_num(std::chrono::steady_clock::time_point now, std::chrono::steady_clock::duration wait)
+    {
+        over_target_num_ = wait > target_wait_ ? over_target_num_ + 1 : 0;
+        bool pressure = over_target_num_ >= kGrowStreak || 
+            queue_.size() > static_cast<std::size_t>(alive_thread_num_) * kBacklogPerThread;
+        if (pressure && alive_thread_num_ < max_thread_num_ && !draining_ && !stop_ && 
+            now - last_resize_ >= kGrowInterval)
+        {
+            spawn_worker();
+            last_resize_ = now;
+            over_target_num_ = 0;
+        }
+    }
+
+    // called with mutex_ held when an idle wait timed out
+    bool should_retire(std::chrono::steady_clock::time_point now)
+    {
+        if (alive_thread_num_ <= thread_num_ || now - last_resize_ < idle_timeout_)
+        {
+            return false;
+        }
+        last_resize_ = now;
+        return true;
+    }
+
+    void loop_resume_coroutine(std::size_t slot)
+    {
+        WorkerCounters& counters = *current_counters_;
+        CoHandleWithPriority co_handle;
+        bool flushed = true;
+        while (true)
+        {
+            std::unique_lock lk(mutex_);
+            while (true)
+            {
+                if (!timers_.empty())
+                {
+                    fire_timers(std::chrono::steady_clock::now());
+                }
+                if (!strand_fired_.empty())
+                {
+                    std::vector<coroutine_handle<CoTask::promise_type>> fired;
+                    fired.swap(strand_fired_);
+                    lk.unlock();
+                    for (auto& handle : fired)
+                    {
+                        schedule_coroutine(handle);
+                    }
+                    lk.lock();
+                    continue;
+                }
+                if (stop_)
+                {
+                    return;
+                }
+                if (take(slot, co_handle, counters))
+                {
+                    break;
+                }
+                if (draining_)
+                {
+                    return;
+                }
+                if (!flushed)
+                {
+                    // hand batched payload frees back before sleeping so empty slabs get recycled
+                    lk.unlock();
+                    MessageArena::instance().flush();
+                    lk.lock();
+                    flushed = true;
+                    continue;
+                }
+                // other workers hold pinned resumes, look again when they become old enough to steal
+                bool watch = affinity_ && local_num_ > 0;
+                if (epoll_fd_ >= 0 && !polling_)
+                {
+                    if (poll_io(lk, slot, watch, counters))
+                    {
+                        return;
+                    }
+                    continue;
+                }
+                ++wait_thread_num;
+                auto idle_start = std::chrono::steady_clock::now();
+                WorkerQueue& own = worker_queues_[slot];
+                std::condition_variable& cv = affinity_ ? own.cv : cv_;
+                own.idle = affinity_;
+                steal_waiters_ += watch;
+                if (!elastic() && timers_.empty() && !watch)
+                {
+                    cv.wait(lk);
+                }else 
+                {
+                    auto idle_deadline = idle_start + idle_timeout_;
+                    auto deadline = idle_deadline;
+                    if (!timers_.empty() && timers_.begin()->first < deadline)
+                    {
+                        deadline = timers_.begin()->first;
+                    }
+                    if (watch && idle_start + kStealAge < deadline)
+                    {
+                        deadline = idle_start + kStealAge;
+                    }
+                    if (cv.wait_until(lk, deadline) == std::cv_status::timeout && elastic() && 
+                        deadline == idle_deadline && queue_.empty() && own.queue.empty() && 
+                        should_retire(std::chrono::steady_clock::now()))
+                    {
+                        --wait_thread_num;
+                        steal_waiters_ -= watch;
+                        own.idle = false;
+                        counters.idle_ns.fetch_add(elapsed_ns(idle_start, std::chrono::steady_clock::now()), std::memory_order_relaxed);
+                        return;
+                    }
+                }
+                own.idle = false;
+                steal_waiters_ -= watch;
+                --wait_thread_num;
+                counters.wakeups.fetch_add(1, std::memory_order_relaxed);
+                counters.idle_ns.fetch_add(elapsed_ns(idle_start, std::chrono::steady_clock::now()), std::memory_order_relaxed);
+            }
+            queue_depth_.store(queue_.size() + local_num_, std::memory_order_relaxed);
+            if (epoll_fd_ >= 0 && !polling_ && wait_thread_num > 0)
+            {
+                // nobody is watching the fds while we run, hand the poller role to a sleeper
+                wake_one();
+            }
+            flushed = false;
+            auto now = std::chrono::steady_clock::now();
+            uint64_t wait = elapsed_ns(co_handle.enqueue_time, now);
+            last_wait_ns_.store(wait, std::memory_order_relaxed);
+            counters.wait_ns.fetch_add(wait, std::memory_order_relaxed);
+            if (elastic())
+            {
+                adjust_thread_num(now, now - co_handle.enqueue_time);
+            }
+            lk.unlock();
+            while (co_handle.handle.promise().suspending_.load(std::memory_order_acquire))
+            {
+                std::this_thread::yield();
+            }
+            bool tracing = Tracer::enabled();
+            uint64_t flow = std::exchange(co_handle.handle.promise().trace_flow_, 0);
+            // the frame may be gone once resume returns, so note the strand we run under now
+            Strand* strand = co_handle.handle.promise().strand_;
+            if (affinity_)
+            {
+                co_handle.handle.promise().affinity_executor_ = this;
+                co_handle.handle.promise().affinity_slot_ = static_cast<uint32_t>(slot);
+            }
+            if (tracing)
+            {
+                Tracer::instance().record(TraceKind::ResumeBegin, flow);
+            }
+            co_handle.handle.resume();
+            if (tracing)
+            {
+                Tracer::instance().record(TraceKind::ResumeEnd, flow);
+            }
+            if (strand)
+            {
+                release_strand(strand);
+            }
+            counters.resumes.fetch_add(1, std::memory_order_relaxed);
+            counters.busy_ns.fetch_add(elapsed_ns(now, std::chrono::steady_clock::now()), std::memory_order_relaxed);
+        }
+    }
+    private:
+    static constexpr int kGrowStreak = 4;
+    static constexpr std::size_t kBacklogPerThread = 8;
+    static constexpr std::chrono::milliseconds kGrowInterval{10};
+    static constexpr std::size_t kStealBacklog = 2;
+    static constexpr std::chrono::microseconds kStealAge{200};
+    static constexpr int kIoBatch = 64;
+
+    struct WorkerQueue
+    {
+        std::priority_queue<CoHandleWithPriority> queue;
+        std::condition_variable cv;
+        bool idle = false;      // asleep on cv and not yet woken
+        bool alive = false;
+    };
+
+    std::priority_queue<CoHandleWithPriority> queue_;
+    TimerMap timers_;
+    std::vector<std::thread> thread_pool_;
+    std::vector<std::thread::id> exited_;
+    // strand-bound timer and I/O resumes, routed through their strand once mutex_ is released
+    std::vector<coroutine_handle<CoTask::promise_type>> strand_fired_;
+    int thread_num_;
+    int max_thread_num_;
+    std::chrono::microseconds target_wait_{0};
+    std::chrono::milliseconds idle_timeout_{1000};
+    std::chrono::steady_clock::time_point last_resize_;
+    int over_target_num_ = 0;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    uint16_t wait_thread_num = 0;
+    int alive_thread_num_ = 0;
+    bool stop_ = false;
+    bool draining_ = false;
+    std::unique_ptr<WorkerCounters[]> counters_;
+    std::size_t counter_num_ = 0;
+    std::vector<bool> slot_used_;
+    std::unique_ptr<WorkerQueue[]> worker_queues_;
+    std::size_t local_num_ = 0;
+    int steal_waiters_ = 0;
+    bool affinity_ = false;
+    int epoll_fd_ = -1;
+    int event_fd_ = -1;
+    bool polling_ = false;      // a worker is in epoll_wait
+    bool kicked_ = false;       // the eventfd was written and not drained yet
+    std::size_t poll_slot_ = 0;
+    std::unordered_map<int, IoWatch> io_watches_;
+    std::atomic<std::size_t> queue_depth_{0};
+    std::atomic<uint64_t> last_wait_ns_{0};
+    // SimExecutor state: resumes collect in sim_ready_ for its step() to pick from, timers run on sim_now_
+    bool simulated_ = false;
+    std::vector<coroutine_handle<CoTask::promise_type>> sim_ready_;
+    std::chrono::steady_clock::time_point sim_now_;
+};
+
+
+class TimerAwait
+{
+    public:
+    bool await_ready()
+    {
+        return cancelled_ || co_executor_->clock_now() >= deadline_;
+    }
+    bool await_suspend(coroutine_handle<CoTask::promise_type> handle)
+    {
+        handle_.store(handle);
+        auto& promise = handle.promise();
+        promise.suspending_ = true;
+        promise.state_ = CoState::StopState;
+        promise.await = this;
+        bool suspend = !(cancelled_ && promise.reclaim());
+        if (suspend)
+        {
+            co_executor_->add_timer(this);
+        }
+        promise.suspending_.store(false, std::memory_order_release);
+        return suspend;
+    }
+    void await_resume()
+    {
+        if (handle_)
+        {
+            handle_.promise().state_ = CoState::NormalState;
+        }
+    }
+    ~TimerAwait()
+    {
+        cancel_binding_.reset();
+        co_executor_->cancel_timer(this);
+    }
+    TimerAwait(TimerAwait&&) = delete;
+
+    void set_cancellation_token(const CancellationToken& token)
+    {
+        if (!cancel_binding_.bind(token, &TimerAwait::on_cancel, this))
+        {
+            on_cancel(this);
+        }
+    }
+    bool cancelled() const
+    {
+        return cancelled_;
+    }
+    private:
+    TimerAwait(CoExecutor* co_executor, std::chrono::steady_clock::time_point deadline):
+        co_executor_(co_executor),
+        deadline_(deadline)
+    {
+    }
+
+    static void on_cancel(void* self);
+    bool pending()
+    {
+        return fired_ || await_ready();
+    }
+    bool poll()
+    {
+        return pending();
+    }
+    void arm(coroutine_handle<CoTask::promise_type> handle, void* select)
+    {
+        handle_.store(handle);
+        select_ = select;
+        co_executor_->add_timer(this);
+    }
+    void disarm()
+    {
+        co_executor_->cancel_timer(this);
+        select_ = nullptr;
+    }
+
+    friend class CoExecutor;
+    template<typename... Awaits>
+    friend class WhenAnyAwait;
+    CoExecutor* co_executor_ = nullptr;
+    std::chrono::steady_clock::time_point deadline_;
+    AtomicCoHandle handle_;
+    std::atomic<void*> select_{nullptr};
+    bool armed_ = false;
+    std::atomic<bool> fired_ = false;
+    std::atomic<bool> cancelled_ = false;
+    CancellationBinding cancel_binding_;
+    CoExecutor::TimerMap::iterator iter_;
+};
+
+inline TimerAwait CoExecutor::create_timer_await(std::chrono::steady_clock::duration timeout)
+{
+    return {this, clock_now() + timeout};
+}
+
+inline void TimerAwait::on_cancel(void* self)
+{
+    auto timer = static_cast<TimerAwait*>(self);
+    timer->cancelled_ = true;
+    timer->co_executor_->cancel_timer(timer);
+    auto handle = timer->handle_.load();
+    if (!handle) return;
+    void* await = handle.promise().await;
+    if (await == timer || (timer->select_ && await == timer->select_))
+    {
+        timer->co_executor_->resume_coroutine(handle);
+    }
+}
+
+inline void CoExecutor::add_timer(TimerAwait* timer)
+{
+    std::lock_guard lk(mutex_);
+    if (timer->armed_) return;
+    timer->fired_ = false;
+    timer->armed_ = true;
+    timer->iter_ = timers_.emplace(timer->deadline_, timer);
+    if (timer->iter_ == timers_.begin())
+    {
+        wake_one();
+    }
+}
+
+inline void CoExecutor::cancel_timer(TimerAwait* timer)
+{
+    std::lock_guard lk(mutex_);
+    if (!timer->armed_) return;
+    timers_.erase(timer->iter_);
+    timer->armed_ = false;
+}
+
+// called with mutex_ held, so an expired TimerAwait can't be destroyed underneath us
+inline void CoExecutor::fire_timers(std::chrono::steady_clock::time_point now)
+{
+    while (!timers_.empty() && timers_.begin()->first <= now)
+    {
+        TimerAwait* timer = timers_.begin()->second;
+        timers_.erase(timers_.begin());
+        timer->armed_ = false;
+        auto handle = timer->handle_.load();
+        auto& promise = handle.promise();
+        void* await = promise.await;
+        if ((await == timer || (timer->select_ && await == timer->select_)) && promise.acquire())
+        {
+            timer->fired_ = true;
+            if (promise.strand_)
+            {
+                // routing through the strand may lock another executor, do it after unlocking
+                strand_fired_.push_back(handle);
+                continue;
+            }
+            queue_.push({handle, 0, now});
+            queue_depth_.store(queue_.size() + local_num_, std::memory_order_relaxed);
+            wake_one();
+        }
+    }
+}
+
+
+inline bool set_nonblocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL);
+    return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+// co_await of a file descriptor through the executor's reactor. Read, write and accept try the
+// call first and only wait for readiness when it would block, so a busy socket costs no epoll
+// round trip. Yields the call's result, or -1 with errno set: ECANCELED when cancelled, EBUSY if
+// the fd already has a waiter in that direction, EPERM for fds epoll can't watch (regular files).
+// wait_readable/wait_writable yield the ready epoll event mask. Writes may be partial.
+class IoAwait
+{
+    public:
+    bool await_ready()
+    {
+        if (cancelled_)
+        {
+            finish(-1, ECANCELED);
+            return true;
+        }
+        return attempt();
+    }
+    bool await_suspend(coroutine_handle<CoTask::promise_type> handle)
+    {
+        handle_.store(handle);
+        auto& promise = handle.promise();
+        promise.suspending_ = true;
+        promise.state_ = CoState::StopState;
+        promise.await = this;
+        bool suspend = !(cancelled_ && promise.reclaim());
+        if (suspend && !co_executor_->watch_io(this))
+        {
+            // watch_io left the error as our result
+            suspend = !promise.reclaim();
+        }
+        promise.suspending_.store(false, std::memory_order_release);
+        return suspend;
+    }
+    ssize_t await_resume()
+    {
+        if (handle_)
+        {
+            handle_.promise().state_ = CoState::NormalState;
+        }
+        if (!done_)
+        {
+            if (cancelled_)
+            {
+                finish(-1, ECANCELED);
+            }else if (!attempt())
+            {
+                // readiness was spurious, e.g. another reader got there first
+                finish(-1, EAGAIN);
+            }
+        }
+        errno = error_;
+        return result_;
+    }
+    ~IoAwait()
+    {
+        cancel_binding_.reset();
+        co_executor_->unwatch_io(this);
+    }
+    IoAwait(IoAwait&&) = delete;
+
+    void set_cancellation_token(const CancellationToken& token)
+    {
+        if (!cancel_binding_.bind(token, &IoAwait::on_cancel, this))
+        {
+            on_cancel(this);
+        }
+    }
+    bool cancelled() const
+    {
+        return cancelled_;
+    }
+    private:
+    enum class Op : uint8_t
+    {
+        Readable,
+        Writable,
+        Read,
+        Write,
+        Accept,
+    };
+
+    IoAwait(CoExecutor* co_executor, int fd, Op op, void* buffer = nullptr, std::size_t size = 0):
+        co_executor_(co_executor),
+        fd_(fd),
+        op_(op),
+        buffer_(buffer),
+        size_(size)
+    {
+    }
+
+    static void on_cancel(void* self);
+    bool writes() const
+    {
+        return op_ == Op::Writable || op_ == Op::Write;
+    }
+    void finish(ssize_t result, int error)
+    {
+        result_ = result;
+        error_ = error;
+        done_ = true;
+    }
+    // false if the call would block
+    bool attempt()
+    {
+        ssize_t r = -1;
+        do
+        {
+            switch (op_)
+            {
+                case Op::Readable:
+                case Op::Writable:
+                    if (ready_events_ == 0) return false;
+                    finish(ready_events_, 0);
+                    return true;
+                case Op::Read: r = read(fd_, buffer_, size_); break;
+                case Op::Write: r = write(fd_, buffer_, size_); break;
+                case Op::Accept: r = accept4(fd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC); break;
+            }
+        }while (r < 0 && errno == EINTR);
+        if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            return false;
+        }
+        finish(r, r < 0 ? errno : 0);
+        return true;
+    }
+
+    friend class CoExecutor;
+    CoExecutor* co_executor_;
+    int fd_;
+    Op op_;
+    void* buffer_;
+    std::size_t size_;
+    AtomicCoHandle handle_;
+    uint32_t ready_events_ = 0;
+    ssize_t result_ = 0;
+    int error_ = 0;
+    bool done_ = false;
+    std::atomic<bool> cancelled_ = false;
+    CancellationBinding cancel_binding_;
+};
+
+inline IoAwait CoExecutor::wait_readable(int fd)
+{
+    return {this, fd, IoAwait::Op::Readable};
+}
+
+inline IoAwait CoExecutor::wait_writable(int fd)
+{
+    return {this, fd, IoAwait::Op::Writable};
+}
+
+inline IoAwait CoExecutor::async_read(int fd, void* buffer, std::size_t size)
+{
+    return {this, fd, IoAwait::Op::Read, buffer, size};
+}
+
+inline IoAwait CoExecutor::async_write(int fd, const void* data, std::size_t size)
+{
+    return {this, fd, IoAwait::Op::Write, const_cast<void*>(data), size};
+}
+
+inline IoAwait CoExecutor::async_accept(int listen_fd)
+{
+    return {this, listen_fd, IoAwait::Op::Accept};
+}
+
+inline void IoAwait::on_cancel(void* self)
+{
+    auto io = static_cast<IoAwait*>(self);
+    io->cancelled_ = true;
+    io->co_executor_->unwatch_io(io);
+    auto handle = io->handle_.load();
+    if (handle && handle.promise().await == io)
+    {
+        io->co_executor_->resume_coroutine(handle);
+    }
+}
+
+inline bool CoExecutor::watch_io(IoAwait* io)
+{
+    std::lock_guard lk(mutex_);
+    if (epoll_fd_ < 0)
+    {
+        io->finish(-1, ENOTSUP);
+        return false;
+    }
+    IoWatch& watch = io_watches_[io->fd_];
+    IoAwait*& waiter = io->writes() ? watch.writer : watch.reader;
+    if (waiter)
+    {
+        io->finish(-1, EBUSY);
+        return false;
+    }
+    waiter = io;
+    if (!arm_io(io->fd_, watch))
+    {
+        waiter = nullptr;
+        io->finish(-1, errno);
+        return false;
+    }
+    return true;
+}
+
+inline void CoExecutor::unwatch_io(IoAwait* io)
+{
+    std::lock_guard lk(mutex_);
+    auto it = io_watches_.find(io->fd_);
+    if (it == io_watches_.end())
+    {
+        return;
+    }
+    IoAwait*& waiter = io->writes() ? it->second.writer : it->second.reader;
+    if (waiter != io)
+    {
+        return;
+    }
+    waiter = nullptr;
+    // narrow the interest to whoever is left; with nobody left a stray event just finds no waiter
+    if (it->second.reader || it->second.writer)
+    {
+        arm_io(io->fd_, it->second);
+    }
+}
+
+// called with mutex_ held; one-shot, so each event is delivered once and re-armed on demand
+inline bool CoExecutor::arm_io(int fd, IoWatch& watch)
+{
+    epoll_event ev{};
+    ev.events = EPOLLONESHOT | (watch.reader ? EPOLLIN | EPOLLRDHUP : 0u) | (watch.writer ? EPOLLOUT : 0u);
+    ev.data.fd = fd;
+    if (epoll_ctl(epoll_fd_, watch.registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, &ev) < 0)
+    {
+        // closing an fd drops it from epoll, and its number may have been reused since
+        if (errno != (watch.registered ? ENOENT : EEXIST) || 
+            epoll_ctl(epoll_fd_, watch.registered ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, fd, &ev) < 0)
+        {
+            return false;
+        }
+    }
+    watch.registered = true;
+    return true;
+}
+
+// called with mutex_ held, like fire_timers, so a watched IoAwait can't be destroyed underneath us
+inline void CoExecutor::fire_io(const epoll_event* events, int n)
+{
+    for (int i = 0; i < n; ++i)
+    {
+        int fd = events[i].data.fd;
+        if (fd == event_fd_)
+        {
+            uint64_t value;
+            [[maybe_unused]] auto r = read(event_fd_, &value, sizeof(value));
+            kicked_ = false;
+            continue;
+        }
+        auto it = io_watches_.find(fd);
+        if (it == io_watches_.end())
+        {
+            continue;
+        }
+        IoWatch& watch = it->second;
+        uint32_t ready = events[i].events;
+        bool failed = ready & (EPOLLERR | EPOLLHUP);
+        if (watch.reader && (failed || (ready & (EPOLLIN | EPOLLRDHUP))))
+        {
+            fire_io_await(std::exchange(watch.reader, nullptr), ready);
+        }
+        if (watch.writer && (failed || (ready & EPOLLOUT)))
+        {
+            fire_io_await(std::exchange(watch.writer, nullptr), ready);
+        }
+        if (watch.reader || watch.writer)
+        {
+            arm_io(fd, watch);
+        }
+    }
+}
+
+inline void CoExecutor::fire_io_await(IoAwait* io, uint32_t ready)
+{
+    auto handle = io->handle_.load();
+    auto& promise = handle.promise();
+    if (promise.await != io || !promise.acquire())
+    {
+        return;
+    }
+    io->ready_events_ = ready;
+    if (promise.strand_)
+    {
+        strand_fired_.push_back(handle);
+        return;
+    }
+    queue_.push({handle, 0, std::chrono::steady_clock::now()});
+    queue_depth_.store(queue_.size() + local_num_, std::memory_order_relaxed);
+    wake_one();
+}
+
+
+// Serial lane on top of a CoExecutor: coroutines bound to one strand never run at the same time
+// and run in the order they were scheduled, so state owned by the strand needs no lock.
+// Scheduling pushes the promise onto a lock-free inbox (a Treiber stack linked through the
+// promise); count_ decides ownership: whoever takes it from 0 dispatches the head, and each
+// finished run hands the strand to the next waiting coroutine. Bind with co_await resume_on(&strand).
+class Strand
+{
+    public:
+    explicit Strand(CoExecutor* co_executor):co_executor_(co_executor)
+    {
+    }
+    Strand(const Strand&) = delete;
+    Strand& operator=(const Strand&) = delete;
+
+    CoExecutor* executor() const
+    {
+        return co_executor_;
+    }
+
+    private:
+    friend class CoExecutor;
+    using promise_type = CoTask::promise_type;
+
+    // true if the caller now owns the strand and must dispatch the next coroutine
+    bool push(promise_type* promise)
+    {
+        promise_type* head = inbox_.load(std::memory_order_relaxed);
+        do
+        {
+            promise->strand_next_ = head;
+        }while (!inbox_.compare_exchange_weak(head, promise, std::memory_order_release, std::memory_order_relaxed));
+        return count_.fetch_add(1, std::memory_order_acq_rel) == 0;
+    }
+
+    // owner only; every counted push has already linked its promise, so this never comes up empty
+    promise_type* pop()
+    {
+        if (!ready_)
+        {
+            // the inbox is newest first, reversing it restores FIFO
+            promise_type* list = inbox_.exchange(nullptr, std::memory_order_acquire);
+            while (list)
+            {
+                promise_type* next = list->strand_next_;
+                list->strand_next_ = ready_;
+                ready_ = list;
+                list = next;
+            }
+        }
+        promise_type* promise = ready_;
+        ready_ = promise->strand_next_;
+        return promise;
+    }
+
+    // true if another coroutine is waiting, the caller keeps ownership and must dispatch it
+    bool release()
+    {
+        return count_.fetch_sub(1, std::memory_order_acq_rel) != 1;
+    }
+
+    void dispatch_next()
+    {
+        promise_type* next = pop();
+        next->strand_executor_->push_ready(coroutine_handle<promise_type>::from_promise(*next), next->strand_priority_);
+    }
+
+    CoExecutor* co_executor_;
+    std::atomic<promise_type*> inbox_{nullptr};
+    promise_type* ready_ = nullptr;
+    std::atomic<uint32_t> count_{0};
+};
+
+inline void CoExecutor::schedule_coroutine(const coroutine_handle<CoTask::promise_type>& handle, uint8_t priority)
+{
+    auto& promise = handle.promise();
+    if (!promise.strand_)
+    {
+        push_ready(handle, priority);
+        return;
+    }
+    promise.strand_executor_ = this;
+    promise.strand_priority_ = priority;
+    if (promise.strand_->push(&promise))
+    {
+        promise.strand_->dispatch_next();
+    }
+}
+
+inline void CoExecutor::release_strand(Strand* strand)
+{
+    if (strand->release())
+    {
+        strand->dispatch_next();
+    }
+}
+
+inline std::size_t CoExecutor::drop_queue(std::priority_queue<CoHandleWithPriority>& queue)
+{
+    std::size_t dropped = 0;
+    for (; !queue.empty(); queue.pop())
+    {
+        // a queued strand coroutine owns its strand, whatever is parked behind it never runs either
+        Strand* strand = queue.top().handle.promise().strand_;
+        dropped += strand ? strand->count_.load(std::memory_order_acquire) : 1;
+    }
+    return dropped;
+}
+
+
+// Hops the awaiting coroutine onto another executor, or onto a strand. The hop is just a push
+// onto the target's queue; the await lives in the coroutine frame, so it doesn't allocate.
+// Hopping to a plain executor leaves any strand the coroutine was bound to.
+class ResumeOnAwait
+{
+    public:
+    explicit ResumeOnAwait(CoExecutor* co_executor, Strand* strand = nullptr):
+        co_executor_(co_executor),
+        strand_(strand)
+    {
+    }
+    bool await_ready()
+    {
+        return false;
+    }
+    void await_suspend(coroutine_handle<CoTask::promise_type> handle)
+    {
+        handle_ = handle;
+        auto& promise = handle.promise();
+        // no waker can acquire us while we're in QueueResume, the target executor owns the resume
+        promise.await = this;
+        promise.state_ = CoState::QueueResume;
+        promise.strand_ = strand_;
+        co_executor_->schedule_coroutine(handle);
+    }
+    void await_resume()
+    {
+        handle_.promise().state_ = CoState::NormalState;
+    }
+
+    private:
+    CoExecutor* co_executor_;
+    Strand* strand_;
+    coroutine_handle<CoTask::promise_type> handle_;
+};
+
+// Executor for handlers that block (file writes, sleeps, compression). It is an elastic pool
+// that grows as soon as hops start queueing, so one stuck handler doesn't hold up the next.
+class BlockingPool : public CoExecutor
+{
+    public:
+    explicit BlockingPool(int max_thread_num, std::chrono::milliseconds idle_timeout = std::chrono::milliseconds(5000)):
+        CoExecutor(1, max_thread_num, std::chrono::microseconds(100), idle_timeout)
+    {
+    }
+};
+
+// co_await offload(pool) before the blocking part, co_await resume_on(executor) after it
+inline ResumeOnAwait resume_on(CoExecutor* co_executor)
+{
+    return ResumeOnAwait(co_executor);
+}
+
+inline ResumeOnAwait resume_on(Strand* strand)
+{
+    return ResumeOnAwait(strand->executor(), strand);
+}
+
+inline ResumeOnAwait offload(BlockingPool* pool)
+{
+    return ResumeOnAwait(pool);
+}
+
+
+template<typename T>
+class MessageBus;
+
+// Subscribers of one topic in a dense array. Each await keeps its own slot_ so removal is a
+// swap with the last entry, and fan-out walks contiguous pointers. Only reaching a new
+// high-water mark of subscribers for a topic allocates.
+template<typename Await>
+class SubscriberList
+{
+    public:
+    using const_iterator = typename std::vector<Await*>::const_iterator;
+
+    void add(Await* await)
+    {
+        await->slot_ = awaits_.size();
+        awaits_.push_back(await);
+    }
+    void remove(Await* await)
+    {
+        std::size_t slot = await->slot_;
+        awaits_[slot] = awaits_.back();
+        awaits_[slot]->slot_ = slot;
+        awaits_.pop_back();
+    }
+    std::size_t size() const
+    {
+        return awaits_.size();
+    }
+    Await* front() const
+    {
+        return awaits_.front();
+    }
+    const_iterator begin() const
+    {
+        return awaits_.begin();
+    }
+    const_iterator end() const
+    {
+        return awaits_.end();
+    }
+
+    private:
+    std::vector<Await*> awaits_;
+};
+
+template<typename T>
+class SharedMessageAwait
+{
+    public:
+    bool await_ready()
+    {
+        return cancelled_ || queue_->try_dequeue(data_);
+    }
+    bool await_suspend(coroutine_handle<CoTask::promise_type> handle)
+    {
+        handle_.store(handle);
+        auto& promise = handle.promise();
+        promise.suspending_ = true;
+        promise.state_ = CoState::StopState;
+        promise.await = this;
+        bool suspend = true;
+        T data;
+        if (cancelled_)
+        {
+            suspend = !promise.reclaim();
+        }else if (queue_->try_dequeue(data))
+        {
+            if (promise.reclaim())
+            {
+                data_ = std::move(data);
+                suspend = false;
+            }else 
+            {
+                queue_->enqueue(std::move(data));
+            }
+        }
+        promise.suspending_.store(false, std::memory_order_release);
+        return suspend;
+    }
+
+    T&& await_resume()
+    { 
+        if (cancelled_ && !ready_)
+        {
+            data_ = T{};
+        }
+        ready_ = false;
+        if (handle_)
+        {
+            handle_.promise().state_ = CoState::NormalState;
+        }
+        return std::move(data_);
+    }
+    T&& take()
+    {
+        ready_ = false;
+        return std::move(data_);
+    }
+    void set_cancellation_token(const CancellationToken& token)
+    {
+        if (!cancel_binding_.bind(token, &SharedMessageAwait::on_cancel, this))
+        {
+            on_cancel(this);
+        }
+    }
+    bool cancelled() const
+    {
+        return cancelled_;
+    }
+    ~SharedMessageAwait();
+    private:
+    SharedMessageAwait(MessageBus<T>* message_bus, CoExecutor* co_executor, const std::string& wait_message_name, 
+        std::shared_ptr<moodycamel::ConcurrentQueue<T>> queue = nullptr);
+    SharedMessageAwait<T> clone()
+    {
+        return {message_bus_, co_executor_, wait_message_name_, queue_};
+    }
+
+    bool push_message(T data)
+    {
+        return queue_->enqueue(std::move(data));
+    }
+    bool waiting() const
+    {
+        auto handle = handle_.load();
+        if (!handle) return false;
+        void* await = handle.promise().await;
+        return await == this || (await != nullptr && await == select_.load(std::memory_order_relaxed));
+    }
+    bool resume_one_coroutine(const T& data)
+    {
+        if (!waiting() || !handle_.promise().acquire())
+        {
+            return false;
+        }
+        data_ = data;
+        ready_ = true;
+        co_executor_->schedule_coroutine(handle_.load());
+        return true;
+    }
+    // cancel leaves the subscriber list straight away, the await just answers cancelled() from then on
+    static void on_cancel(void* self)
+    {
+        auto await = static_cast<SharedMessageAwait<T>*>(self);
+        await->cancelled_ = true;
+        await->detach();
+        if (await->waiting())
+        {
+            await->co_executor_->resume_coroutine(await->handle_.load());
+        }
+    }
+    void detach()
+    {
+        if (detached_) return;
+        detached_ = true;
+        message_bus_->remove_await(this);
+    }
+    bool pending() const
+    {
+        return ready_ || cancelled_ || queue_->size_approx() > 0;
+    }
+    bool poll()
+    {
+        return ready_ || cancelled_ || queue_->try_dequeue(data_);
+    }
+    void arm(coroutine_handle<CoTask::promise_type> handle, void* select)
+    {
+        handle_.store(handle);
+        select_.store(select, std::memory_order_relaxed);
+    }
+    void disarm()
+    {
+        select_.store(nullptr, std::memory_order_relaxed);
+    }
+    friend class MessageBus<T>;
+    friend class SubscriberList<SharedMessageAwait<T>>;
+    template<typename... Awaits>
+    friend class WhenAnyAwait;
+    std::string wait_message_name_;
+    std::shared_ptr<moodycamel::ConcurrentQueue<T>> queue_;
+    MessageBus<T>* message_bus_ = nullptr;
+    CoExecutor* co_executor_ = nullptr;
+    AtomicCoHandle handle_;
+    std::atomic<void*> select_{nullptr};
+    std::atomic<bool> ready_ = false;
+    std::atomic<bool> cancelled_ = false;
+    bool detached_ = false;
+    CancellationBinding cancel_binding_;
+    T data_;
+    std::size_t slot_ = 0;
+};
+template<typename T>
+class MessageAwait;
+
+enum class SlowSubscriberReason : uint8_t
+{
+    Backlog = 0,        // queued messages reached max_backlog
+    HandlerTime = 1,    // ran longer than max_handler_time between two co_awaits
+};
+
+enum class SlowSubscriberAction : uint8_t
+{
+    Flag = 0,           // only mark it and call on_slow
+    Isolate = 1,        // resume it on isolation_executor from now on
+    DropNewest = 2,     // while over max_backlog, new messages for it are dropped
+};
+
+// Per-bus limits for MessageAwait subscribers; set it before run(). A subscriber is flagged
+// once, on whichever thread noticed it; after that the action stays in force for its lifetime.
+struct SlowSubscriberPolicy
+{
+    std::size_t max_backlog = 0;                    // 0 disables the backlog check
+    std::chrono::nanoseconds max_handler_time{0};   // 0 disables the run time check
+    SlowSubscriberAction action = SlowSubscriberAction::Flag;
+    CoExecutor* isolation_executor = nullptr;
+    // called with no bus lock held, so it may subscribe, publish or read topic_stats()
+    std::function<void(std::string_view topic, SlowSubscriberReason reason)> on_slow;
+};
+
+// co_await await.next_batch(buffer, max) moves up to max queued messages into buffer and yields
+// how many were taken; it only suspends when the subscriber queue is empty.
+template<typename T>
+class BatchMessageAwait
+{
+    public:
+    bool await_ready()
+    {
+        await_.handler_done();
+        if (await_.migrating_.load(std::memory_order_relaxed) && !await_.cancelled_)
+        {
+            return false;
+        }
+        count_ = await_.cancelled_ ? 0 : await_.queue_.try_dequeue_bulk(buffer_, max_);
+        return count_ > 0 || await_.cancelled_;
+    }
+    bool await_suspend(coroutine_handle<CoTask::promise_type> handle)
+    {
+        return await_.suspend(handle);
+    }
+    std::size_t await_resume()
+    {
+        if (await_.suspend_)
+        {
+            count_ = await_.cancelled_ ? 0 : await_.queue_.try_dequeue_bulk(buffer_, max_);
+            assert(count_ > 0 || await_.cancelled_);
+            await_.suspend_ = false;
+            await_.handle_.promise().state_ = CoState::NormalState;
+        }
+        await_.handler_start();
+        return count_;
+    }
+    private:
+    BatchMessageAwait(MessageAwait<T>& await, T* buffer, std::size_t max):
+        await_(await),
+        buffer_(buffer),
+        max_(max)
+    {
+    }
+    friend class MessageAwait<T>;
+    MessageAwait<T>& await_;
+    T* buffer_;
+    std::size_t max_;
+    std::size_t count_ = 0;
+};
+
+template<typename T>
+class MessageAwait
+{
+    public:
+    bool await_ready()
+    {
+        handler_done();
+        if (migrating_.load(std::memory_order_relaxed) && !cancelled_)
+        {
+            return false;
+        }
+        return cancelled_ || queue_.try_dequeue(data_);
+    }
+    bool await_suspend(coroutine_handle<CoTask::promise_type> handle)
+    {
+        return suspend(handle);
+    }
+
+    T&& await_resume()
+    {
+        if (cancelled_)
+        {
+            data_ = T{};
+        }else if (suspend_)
+        {
+            // only a cancel or a queued message resumes a suspended subscriber, and only it dequeues
+            [[maybe_unused]] bool dequeued = queue_.try_dequeue(data_);
+            assert(dequeued);
+        }
+        suspend_ = false;
+        if (handle_)
+        {
+            handle_.promise().state_ = CoState::NormalState;
+        }
+        handler_start();
+        return std::move(data_);
+    }
+    T&& take()
+    {
+        return std::move(data_);
+    }
+    BatchMessageAwait<T> next_batch(T* buffer, std::size_t max)
+    {
+        return {*this, buffer, max};
+    }
+    void set_cancellation_token(const CancellationToken& token)
+    {
+        if (!cancel_binding_.bind(token, &MessageAwait::on_cancel, this))
+        {
+            on_cancel(this);
+        }
+    }
+    bool cancelled() const
+    {
+        return cancelled_;
+    }
+    bool slow() const
+    {
+        return slow_.load(std::memory_order_relaxed);
+    }
+    std::size_t backlog() const
+    {
+        return queue_.size_approx();
+    }
+
+    ~MessageAwait();
+    private:
+    
+    // snapshot: queue what the bus retains for the topic ahead of live traffic
+    MessageAwait(MessageBus<T>* message_bus, CoExecutor* co_executor, const std::string& wait_message_name, bool snapshot = false);
+
+    bool suspend(coroutine_handle<CoTask::promise_type> handle)
+    {
+        suspend_ = true;
+        handle_.store(handle);
+        auto& promise = handle.promise();
+        bool migrating = migrating_.exchange(false, std::memory_order_relaxed);
+        promise.suspending_ = true;
+        promise.state_ = CoState::StopState;
+        promise.await = this;
+        bool suspend = true;
+        // a push that raced with the store above saw a stale await and didn't resume us
+        if ((cancelled_ || queue_.size_approx() > 0) && promise.reclaim())
+        {
+            suspend = false;
+            if (migrating)
+            {
+                // hop over to the isolation executor with the message; QueueResume keeps wakers off
+                promise.state_ = CoState::QueueResume;
+                promise.suspending_.store(false, std::memory_order_release);
+                executor()->schedule_coroutine(handle);
+                return true;
+            }
+        }
+        // with nothing queued a migrating subscriber just waits, executor() already names the
+        // isolation executor for the push that wakes it
+        promise.suspending_.store(false, std::memory_order_release);
+        return suspend;
+    }
+
+    bool waiting() const
+    {
+        void* await = handle_.promise().await;
+        return await == this || (await != nullptr && await == select_.load(std::memory_order_relaxed));
+    }
+    // flagged is set when this push flagged the subscriber slow; the dispatcher holds the
+    // subscriber lock here and calls on_slow once it has let go
+    bool push_message(T data, bool& flagged)
+    {
+        const SlowSubscriberPolicy& policy = message_bus_->slow_subscriber_policy();
+        if (policy.max_backlog > 0 && queue_.size_approx() >= policy.max_backlog)
+        {
+            flagged = mark_slow() || flagged;
+            if (policy.action == SlowSubscriberAction::DropNewest)
+            {
+                dropped_.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+        }
+        // queued even before the first co_await, the subscription starts when the await is created
+        bool r = queue_.enqueue(std::move(data));
+        if (handle_ && waiting())
+        {
+            wake();
+        }
+        return r;
+    }
+    // The only path that resumes a waiting subscriber, for a push and for a cancel alike. A
+    // waker that wins acquire() with nothing to hand over gives the state back and looks again,
+    // so a push or cancel whose acquire() failed meanwhile isn't lost.
+    void wake()
+    {
+        auto handle = handle_.load();
+        auto& promise = handle.promise();
+        while (promise.acquire())
+        {
+            if (cancelled_ || queue_.size_approx() > 0)
+            {
+                executor()->schedule_coroutine(handle);
+                return;
+            }
+            // await_ready already consumed it, resuming now would hand back a stale data_
+            promise.state_ = CoState::StopState;
+            if (!cancelled_ && queue_.size_approx() == 0)
+            {
+                return;
+            }
+        }
+    }
+    static void on_cancel(void* self)
+    {
+        auto await = static_cast<MessageAwait<T>*>(self);
+        await->cancelled_ = true;
+        await->detach();
+        if (await->handle_ && await->waiting())
+        {
+            await->wake();
+        }
+    }
+    void detach()
+    {
+        if (detached_) return;
+        detached_ = true;
+        message_bus_->remove_await(this);
+    }
+    CoExecutor* executor() const
+    {
+        CoExecutor* isolated = isolated_executor_.load(std::memory_order_acquire);
+        return isolated ? isolated : co_executor_;
+    }
+    void handler_start()
+    {
+        if (message_bus_->slow_subscriber_policy().max_handler_time.count() > 0)
+        {
+            handler_started_ = std::chrono::steady_clock::now();
+        }
+    }
+    void handler_done()
+    {
+        auto limit = message_bus_->slow_subscriber_policy().max_handler_time;
+        if (limit.count() > 0 && handler_started_ != std::chrono::steady_clock::time_point{} &&
+            std::chrono::steady_clock::now() - handler_started_ > limit && mark_slow())
+        {
+            const SlowSubscriberPolicy& policy = message_bus_->slow_subscriber_policy();
+            if (policy.on_slow)
+            {
+                policy.on_slow(wait_message_name_, SlowSubscriberReason::HandlerTime);
+            }
+        }
+        handler_started_ = {};
+    }
+    // true only for the call that flagged it; the caller reports it through on_slow
+    bool mark_slow()
+    {
+        if (slow_.exchange(true, std::memory_order_relaxed))
+        {
+            return false;
+        }
+        const SlowSubscriberPolicy& policy = message_bus_->slow_subscriber_policy();
+        if (policy.action == SlowSubscriberAction::Isolate && policy.isolation_executor)
+        {
+            isolated_executor_.store(policy.isolation_executor, std::memory_order_release);
+            // a subscriber that never runs dry never suspends, so make its next co_await move it
+            migrating_.store(true, std::memory_order_relaxed);
+        }
+        return true;
+    }
+    bool pending() const
+    {
+        return cancelled_ || queue_.size_approx() > 0;
+    }
+    bool poll()
+    {
+        return cancelled_ || queue_.try_dequeue(data_);
+    }
+    void arm(coroutine_handle<CoTask::promise_type> handle, void* select)
+    {
+        handle_.store(handle);
+        select_.store(select, std::memory_order_relaxed);
+    }
+    void disarm()
+    {
+        select_.store(nullptr, std::memory_order_relaxed);
+    }
+    friend class MessageBus<T>;
+    friend class SubscriberList<MessageAwait<T>>;
+    friend class BatchMessageAwait<T>;
+    template<typename... Awaits>
+    friend class WhenAnyAwait;
+    std::string wait_message_name_;
+    moodycamel::ConcurrentQueue<T> queue_;
+    MessageBus<T>* message_bus_ = nullptr;
+    CoExecutor* co_executor_ = nullptr;
+    AtomicCoHandle handle_;
+    std::atomic<void*> select_{nullptr};
+    bool suspend_ = false;
+    std::atomic<bool> cancelled_ = false;
+    bool detached_ = false;
+    CancellationBinding cancel_binding_;
+    T data_;
+    std::size_t slot_ = 0;
+    std::atomic<bool> slow_ = false;
+    std::atomic<CoExecutor*> isolated_executor_{nullptr};
+    std::atomic<bool> migrating_ = false;
+    std::atomic<uint64_t> dropped_{0};
+    std::chrono::steady_clock::time_point handler_started_;
+};
+template<typename T>
+class OnceMessageAwait
+{
+    public:
+    bool await_ready()
+    {
+        return ready_ || cancelled_;
+    }
+    bool await_suspend(coroutine_handle<CoTask::promise_type> handle)
+    {
+        handle_.store(handle);
+        auto& promise = handle.promise();
+        promise.suspending_ = true;
+        promise.state_ = CoState::StopState;
+        promise.await = this;
+        // a message claimed before we published await didn't resume us
+        bool suspend = !((ready_ || cancelled_) && promise.reclaim());
+        promise.suspending_.store(false, std::memory_order_release);
+        return suspend;
+    }
+
+    T&& await_resume()
+    {
+        if (cancelled_ && !ready_)
+        {
+            data_ = T{};
+        }
+        ready_ = false;
+        if (handle_)
+        {
+            handle_.promise().state_ = CoState::NormalState;
+        }
+        return std::move(data_);
+    }
+    T&& take()
+    {
+        ready_ = false;
+        return std::move(data_);
+    }
+    void set_cancellation_token(const CancellationToken& token)
+    {
+        if (!cancel_binding_.bind(token, &OnceMessageAwait::on_cancel, this))
+        {
+            on_cancel(this);
+        }
+    }
+    bool cancelled() const
+    {
+        return cancelled_;
+    }
+    ~OnceMessageAwait();
+    private:
+    OnceMessageAwait(MessageBus<T>* message_bus, CoExecutor* co_executor, const std::string& wait_message_name);
+
+    bool waiting() const
+    {
+        void* await = handle_.promise().await;
+        return await == this || (await != nullptr && await == select_.load(std::memory_order_relaxed));
+    }
+    // Keeps the first message dispatched after the await was created, whether or not the
+    // coroutine is waiting yet; claimed_ makes that the only write to data_, so nothing later
+    // clobbers it while the coroutine reads it.
+    bool push_message(T data)
+    {
+        bool expected = false;
+        if (!claimed_.compare_exchange_strong(expected, true))
+        {
+            return false;
+        }
+        data_ = std::move(data);
+        ready_ = true;
+        auto handle = handle_.load();
+        if (handle && waiting() && handle.promise().acquire())
+        {
+            co_executor_->schedule_coroutine(handle);
+        }
+        return true;
+    }
+    static void on_cancel(void* self)
+    {
+        auto await = static_cast<OnceMessageAwait<T>*>(self);
+        await->cancelled_ = true;
+        await->detach();
+        if (await->handle_ && await->waiting())
+        {
+            await->co_executor_->resume_coroutine(await->handle_.load());
+        }
+    }
+    void detach()
+    {
+        if (detached_) return;
+        detached_ = true;
+        message_bus_->remove_await(this);
+    }
+    bool pending() const
+    {
+        return ready_ || cancelled_;
+    }
+    bool poll()
+    {
+        return ready_ || cancelled_;
+    }
+    void arm(coroutine_handle<CoTask::promise_type> handle, void* select)
+    {
+        handle_.store(handle);
+        select_.store(select, std::memory_order_relaxed);
+    }
+    void disarm()
+    {
+        select_.store(nullptr, std::memory_order_relaxed);
+    }
+    friend class MessageBus<T>;
+    friend class SubscriberList<OnceMessageAwait<T>>;
+    template<typename... Awaits>
+    friend class WhenAnyAwait;
+    std::string wait_message_name_;
+    MessageBus<T>* message_bus_ = nullptr;
+    CoExecutor* co_executor_ = nullptr;
+    AtomicCoHandle handle_;
+    std::atomic<void*> select_{nullptr};
+    std::atomic<bool> ready_ = false;
+    std::atomic<bool> claimed_ = false;
+    std::atomic<bool> cancelled_ = false;
+    bool detached_ = false;
+    CancellationBinding cancel_binding_;
+    T data_;
+    std::size_t slot_ = 0;
+};
+
+
+// Suspends on several awaits (bus awaits and TimerAwait) at once. Resumes exactly once and
+// yields the index of the await that is ready; fetch its message with take().
+template<typename... Awaits>
+class WhenAnyAwait
+{
+    public:
+    explicit WhenAnyAwait(Awaits&... awaits):
+        awaits_(awaits...)
+    {
+    }
+    bool await_ready()
+    {
+        return poll_all();
+    }
+    bool await_suspend(coroutine_handle<CoTask::promise_type> handle)
+    {
+        handle_ = handle;
+        auto& promise = handle_.promise();
+        promise.suspending_ = true;
+        std::apply([&](auto&... await){ (await.arm(handle, this), ...); }, awaits_);
+        promise.state_ = CoState::StopState;
+        promise.await = this;
+        // only peek while armed: a waker that wins acquire() may be writing into an await right now
+        bool suspend = true;
+        while (pending_any())
+        {
+            if (!promise.reclaim())
+            {
+                break;
+            }
+            if (poll_all())
+            {
+                disarm_all();
+                suspend = false;
+                break;
+            }
+            promise.state_ = CoState::StopState;
+        }
+        promise.suspending_.store(false, std::memory_order_release);
+        return suspend;
+    }
+    std::size_t await_resume()
+    {
+        if (handle_ && handle_.promise().state_ != CoState::NormalState)
+        {
+            poll_all();
+            disarm_all();
+            handle_.promise().state_ = CoState::NormalState;
+        }
+        std::size_t index = index_;
+        index_ = npos;
+        return index;
+    }
+    static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+
+    private:
+    bool pending_any()
+    {
+        return std::apply([](auto&... await){ return (await.pending() || ...); }, awaits_);
+    }
+    bool poll_all()
+    {
+        return poll_from(std::index_sequence_for<Awaits...>{});
+    }
+    template<std::size_t... I>
+    bool poll_from(std::index_sequence<I...>)
+    {
+        return ((std::get<I>(awaits_).poll() && (index_ = I, true)) || ...);
+    }
+    void disarm_all()
+    {
+        std::apply([](auto&... await){ (await.disarm(), ...); }, awaits_);
+    }
+
+    std::tuple<Awaits&...> awaits_;
+    coroutine_handle<CoTask::promise_type> handle_;
+    std::size_t index_ = npos;
+};
+
+template<typename... Awaits>
+WhenAnyAwait<Awaits...> when_any(Awaits&... awaits)
+{
+    return WhenAnyAwait<Awaits...>(awaits...);
+}
+
+
+enum class AwaitType : uint8_t
+{
+    Invalid = 0,
+    Shared = 1,
+    Once = 2,
+    Normal = 3,
+};
+
+template<typename T>
+struct AwaitTypeTraits
+{
+    const static AwaitType value = AwaitType::Invalid;
+};
+
+
+template<typename T>
+struct AwaitTypeTraits<SharedMessageAwait<T>>
+{
+    const static AwaitType value = AwaitType::Shared;
+};
+template<typename T>
+struct AwaitTypeTraits<MessageAwait<T>>
+{
+    const static AwaitType value = AwaitType::Normal;
+};
+template<typename T>
+struct AwaitTypeTraits<OnceMessageAwait<T>>
+{
+    const static AwaitType value = AwaitType::Once;
+};
+
+
+// lets the await maps be probed with any message name type that converts to std::string_view
+struct TopicHash
+{
+    using is_transparent = void;
+    std::size_t operator()(std::string_view name) const
+    {
+        return std::hash<std::string_view>{}(name);
+    }
+};
+
+struct TopicStats
+{
+    std::string topic;
+    uint64_t messages = 0;
+    uint64_t bytes = 0;                 // payload bytes dispatched, see payload_bytes()
+    uint64_t shared_fallbacks = 0;      // shared group had no idle member, message was queued
+    std::size_t shared_subscribers = 0;
+    std::size_t message_subscribers = 0;
+    std::size_t once_subscribers = 0;
+    std::size_t shared_backlog = 0;
+    std::vector<std::size_t> message_backlogs;  // queued messages per MessageAwait
+    std::size_t slow_subscribers = 0;           // MessageAwaits flagged by SlowSubscriberPolicy
+    uint64_t slow_drops = 0;                    // messages dropped by DropNewest, current subscribers only
+};
+
+// What a bus keeps of a topic for subscribers that join later: the last `last` messages, or,
+// with key set, the latest message per key (last is ignored then).
+template<typename T>
+struct RetentionPolicy
+{
+    std::size_t last = 0;
+    std::function<std::string(const T&)> key;
+};
+
+// Retained messages of one topic, oldest first. Last-N mode is a ring over a vector that never
+// grows past N; keyed mode overwrites each key's entry in place and orders by update on replay.
+template<typename T>
+class RetainedTopic
+{
+    public:
+    explicit RetainedTopic(RetentionPolicy<T> policy):
+        policy_(std::move(policy))
+    {
+        if (!policy_.key)
+        {
+            entries_.reserve(policy_.last);
+        }
+    }
+
+    void add(const T& message)
+    {
+        if (policy_.key)
+        {
+            auto [it, inserted] = index_.try_emplace(policy_.key(message), entries_.size());
+            if (inserted)
+            {
+                entries_.push_back({message, seq_++});
+            }else 
+            {
+                entries_[it->second] = {message, seq_++};
+            }
+        }else if (entries_.size() < policy_.last)
+        {
+            entries_.push_back({message, 0});
+        }else if (policy_.last > 0)
+        {
+            entries_[head_].message = message;
+            head_ = (head_ + 1) % policy_.last;
+        }
+    }
+
+    template<typename F>
+    void for_each(F&& f) const
+    {
+        if (policy_.key)
+        {
+            std::vector<const Entry*> order;
+            order.reserve(entries_.size());
+            for (const Entry& entry : entries_)
+            {
+                order.push_back(&entry);
+            }
+            std::sort(order.begin(), order.end(), [](const Entry* a, const Entry* b) { return a->seq < b->seq; });
+            for (const Entry* entry : order)
+            {
+                f(entry->message);
+            }
+            return;
+        }
+        for (std::size_t i = 0; i < entries_.size(); ++i)
+        {
+            f(entries_[(head_ + i) % entries_.size()].message);
+        }
+    }
+
+    std::size_t size() const
+    {
+        return entries_.size();
+    }
+
+    private:
+    struct Entry
+    {
+        T message;
+        uint64_t seq;
+    };
+
+    RetentionPolicy<T> policy_;
+    std::vector<Entry> entries_;
+    std::size_t head_ = 0;      // oldest entry once the ring is full
+    uint64_t seq_ = 0;
+    std::unordered_map<std::string, std::size_t> index_;
+};
+
+// One publisher lane (see MessageBus::register_publisher); lanes are listed until closed and emptied.
+struct LaneStats
+{
+    std::string name;
+    int priority = 0;
+    std::size_t capacity = 0;
+    std::size_t backlog = 0;        // pushed, not yet taken by the dispatcher
+    uint64_t messages = 0;          // pushed through the lane in total
+    uint64_t full_waits = 0;        // times the publisher waited on a full lane
+};
+
+struct TopicStatsSnapshot
+{
+    std::chrono::steady_clock::time_point taken_at;
+    std::vector<TopicStats> topics;
+    // traffic of map-routed topics first seen after MessageBus::kMaxTrafficTopics were counted
+    TopicStats overflow;
+};
+
+// Bytes a message adds to TopicStats::bytes: its data member when that reads as a string,
+// otherwise 0, so MessageBus<T> takes any type with a name.
+template<typename T>
+std::size_t payload_bytes(const T& msg)
+{
+    if constexpr (requires { std::string_view(msg.data); })
+    {
+        return std::string_view(msg.data).size();
+    }else
+    {
+        return 0;
+    }
+}
+
+// Traffic counters of one topic, split into cache-line shards picked per thread so several
+// dispatching threads don't contend on the same line. Readers sum the shards.
+class TopicTraffic
+{
+    public:
+    void add(uint64_t bytes, bool shared_fallback)
+    {
+        Shard& shard = shards_[shard_index()];
+        shard.messages.fetch_add(1, std::memory_order_relaxed);
+        shard.bytes.fetch_add(bytes, std::memory_order_relaxed);
+        if (shared_fallback)
+        {
+            shard.shared_fallbacks.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    void read(TopicStats& stats) const
+    {
+        for (const Shard& shard : shards_)
+        {
+            stats.messages += shard.messages.load(std::memory_order_relaxed);
+            stats.bytes += shard.bytes.load(std::memory_order_relaxed);
+            stats.shared_fallbacks += shard.shared_fallbacks.load(std::memory_order_relaxed);
+        }
+    }
+
+    private:
+    static constexpr std::size_t kShards = 8;
+    struct alignas(64) Shard
+    {
+        std::atomic<uint64_t> messages{0};
+        std::atomic<uint64_t> bytes{0};
+        std::atomic<uint64_t> shared_fallbacks{0};
+    };
+    static std::size_t shard_index()
+    {
+        static std::atomic<std::size_t> next{0};
+        static thread_local std::size_t index = next.fetch_add(1, std::memory_order_relaxed) % kShards;
+        return index;
+    }
+    Shard shards_[kShards];
+};
+
+// Central queue between publishers and the dispatcher, picked per message type. The default
+// grows without bound; a bus that should give its publishers backpressure can use the bounded
+// single-consumer ring instead, push_message/push_messages then return false while it is full:
+//     template<> struct BusQueue<Quote> { template<typename E> using type = MpscRingQueue<E, 1 << 16>; };
+template<typename T>
+struct BusQueue
+{
+    template<typename E>
+    using type = moodycamel::ConcurrentQueue<E>;
+};
+
+template<typename T>
+class MessageBus
+{   
+    public:
+    MessageBus() = default;
+    ~MessageBus() = default;
+    MessageBus(const MessageBus&) = delete;
+    MessageBus& operator=(const MessageBus&) = delete;
+
+    // distinct map-routed topics topic_stats() counts one by one, the rest add to its overflow
+    static constexpr std::size_t kMaxTrafficTopics = 4096;
+
+    SharedMessageAwait<T> create_shared_message_await(CoExecutor* co_executor, const std::string& wait_message_name)
+    {
+        std::unique_lock lk(shared_message_await_map_mutex_);
+        auto awaits = find_subscribers<SharedMessageAwait<T>>(Routes::route(wait_message_name), wait_message_name);
+        if (awaits && awaits->size() > 0)
+        {
+            return awaits->front()->clone();
+        }
+        return {this, co_executor, wait_message_name};
+    }
+    MessageAwait<T> create_message_await(CoExecutor* co_executor, const std::string& wait_message_name)
+    {
+        std::unique_lock lk(message_await_map_mutex_);
+        return {this, co_executor, wait_message_name};
+    }
+    // Subscribing to a topic of StaticTopics<T>; the name version routes the same way, these
+    // only check the name at compile time.
+    template<TopicName Name>
+    SharedMessageAwait<T> create_shared_message_await(CoExecutor* co_executor)
+    {
+        static_assert(Routes::template route_of<Name> != 0, "topic is not in StaticTopics");
+        return create_shared_message_await(co_executor, std::string(Name.view()));
+    }
+    template<TopicName Name>
+    MessageAwait<T> create_message_await(CoExecutor* co_executor)
+    {
+        static_assert(Routes::template route_of<Name> != 0, "topic is not in StaticTopics");
+        return create_message_await(co_executor, std::string(Name.view()));
+    }
+    template<TopicName Name>
+    OnceMessageAwait<T> create_once_message_await(CoExecutor* co_executor)
+    {
+        static_assert(Routes::template route_of<Name> != 0, "topic is not in StaticTopics");
+        return create_once_message_await(co_executor, std::string(Name.view()));
+    }
+    // Delivers the topic's retained messages first, then live traffic. The snapshot is taken
+    // under the same lock the dispatcher fans out under, so nothing is missed or repeated
+    // at the switch-over.
+    MessageAwait<T> create_snapshot_message_await(CoExecutor* co_executor, const std::string& wait_message_name)
+    {
+        std::unique_lock lk(message_await_map_mutex_);
+        return {this, co_executor, wait_message_name, true};
+    }
+
+    // Starts, changes or (with a default policy) ends retention for a topic; whatever was
+    // retained under the previous policy is dropped.
+    void set_retention(const std::string& topic, RetentionPolicy<T> policy)
+    {
+        std::unique_lock lk(message_await_map_mutex_);
+        std::lock_guard retention_lk(retention_mutex_);
+        if (policy.last == 0 && !policy.key)
+        {
+            retention_map_.erase(topic);
+        }else 
+        {
+            retention_map_[topic] = std::make_unique<RetainedTopic<T>>(std::move(policy));
+        }
+        retention_num_.store(retention_map_.size(), std::memory_order_relaxed);
+    }
+
+    // copy of what a late subscriber to topic would be replayed, oldest first
+    std::vector<T> retained(std::string_view topic)
+    {
+        std::vector<T> result;
+        std::lock_guard lk(retention_mutex_);
+        auto it = retention_map_.find(topic);
+        if (it != retention_map_.end())
+        {
+            result.reserve(it->second->size());
+            it->second->for_each([&result](const T& message) { result.push_back(message); });
+        }
+        return result;
+    }
+
+    // caller holds message_await_map_mutex_ exclusively, await was just added and can't be waited on yet
+    void replay_retained(MessageAwait<T>* await)
+    {
+        std::lock_guard lk(retention_mutex_);
+        auto it = retention_map_.find(await->wait_message_name_);
+        if (it != retention_map_.end())
+        {
+            it->second->for_each([await](const T& message) { await->queue_.enqueue(message); });
+        }
+    }
+    OnceMessageAwait<T> create_once_message_await(CoExecutor* co_executor, const std::string& wait_message_name)
+    {
+        std::unique_lock lk(once_message_await_map_mutex_);
+        return {this, co_executor, wait_message_name};
+    }
+
+    // caller holds the matching map mutex exclusively
+    template<typename Await>
+    void add_await(Await* await)
+    {
+        std::size_t route = Routes::route(await->wait_message_name_);
+        if (route != 0)
+        {
+            auto& awaits = static_subscribers<Await>(routes_[route - 1]);
+            awaits.list.add(await);
+            awaits.size.store(awaits.list.size(), std::memory_order_release);
+        }else
+        {
+            subscriber_map<Await>()[await->wait_message_name_].add(await);
+        }
+    }
+    template<typename Await>
+    void remove_await(Await* await)
+    {
+        std::unique_lock lk(subscriber_mutex<Await>());
+        std::size_t route = Routes::route(await->wait_message_name_);
+        if (route != 0)
+        {
+            auto& awaits = static_subscribers<Await>(routes_[route - 1]);
+            awaits.list.remove(await);
+            awaits.size.store(awaits.list.size(), std::memory_order_release);
+        }else
+        {
+            subscriber_map<Await>()[await->wait_message_name_].remove(await);
+        }
+    }
+
+    void set_slow_subscriber_policy(SlowSubscriberPolicy policy)
+    {
+        slow_subscriber_policy_ = std::move(policy);
+    }
+    const SlowSubscriberPolicy& slow_subscriber_policy() const
+    {
+        return slow_subscriber_policy_;
+    }
+
+    // false if the bus no longer accepts messages or a bounded BusQueue is full; data is then
+    // left as it was, so it can be pushed again
+    bool push_message(T&& data)
+    {
+        std::size_t route = Routes::route(data.name);
+        return push_routed(std::move(data), route);
+    }
+    // publishes to a topic of StaticTopics<T> with its route fixed at compile time; data.name
+    // must still be Name, subscribers and stats see it
+    template<TopicName Name>
+    bool push_message(T&& data)
+    {
+        static_assert(Routes::template route_of<Name> != 0, "topic is not in StaticTopics");
+        assert(std::string_view(data.name) == Name.view());
+        return push_routed(std::move(data), Routes::template route_of<Name>);
+    }
+
+    // Moves count messages in with one bulk enqueue and at most one dispatcher wake-up; on
+    // false, as for push_message, none of them was taken.
+    bool push_messages(T* data, std::size_t count)
+    {
+        ++pushing_num_;
+        if (!accepting_)
+        {
+            leave_push();
+            return false;
+        }
+        bool r = queue_.enqueue_bulk(EnvelopeIterator{data}, count);
+        leave_push();
+        if (suspend_co_num_ > 0 && r)
+        {
+            wake_dispatcher();
+        }
+        return r;
+    }
+
+    class Publisher;
+    // Gives a publishing thread its own bounded SPSC lane into the dispatcher, so publishers
+    // don't contend with each other and each one's messages are dispatched in the order it
+    // pushed them (there is no order across lanes). The dispatcher serves the highest priority
+    // with anything queued, round-robin among equal priorities, in batches; the shared queue
+    // behind push_message counts as priority 0. A full lane makes its publisher wait, so a lane
+    // must only be pushed to while run() is dispatching.
+    Publisher register_publisher(std::string name = {}, std::size_t capacity = 4096, int priority = 0)
+    {
+        auto lane = std::make_shared<Lane>(std::move(name), capacity, priority);
+        std::lock_guard lk(lanes_mutex_);
+        lanes_.push_back(lane);
+        // stable, so equal priorities are served in registration order
+        std::stable_sort(lanes_.begin(), lanes_.end(), [](const auto& a, const auto& b) { return a->priority > b->priority; });
+        lanes_version_.fetch_add(1, std::memory_order_release);
+        return Publisher(this, std::move(lane));
+    }
+
+    std::vector<LaneStats> lane_stats()
+    {
+        std::vector<LaneStats> stats;
+        std::lock_guard lk(lanes_mutex_);
+        stats.reserve(lanes_.size());
+        for (auto& lane : lanes_)
+        {
+            stats.push_back({lane->name, lane->priority, lane->queue.capacity(), lane->queue.size_approx(),
+                lane->queue.pushed(), lane->queue.full_waits()});
+        }
+        return stats;
+    }
+
+    // Counters for every topic that was published to or has subscribers. Rates come from
+    // diffing two snapshots over taken_at.
+    TopicStatsSnapshot topic_stats()
+    {
+        std::map<std::string, TopicStats, std::less<>> topics;
+        auto entry = [&topics](std::string_view name) -> TopicStats& {
+            auto it = topics.find(name);
+            if (it == topics.end())
+            {
+                it = topics.emplace(std::string(name), TopicStats{}).first;
+                it->second.topic = name;
+            }
+            return it->second;
+        };
+        TopicStatsSnapshot snapshot;
+        {
+            std::shared_lock lk(traffic_map_mutex_);
+            for (auto& [name, traffic] : traffic_map_)
+            {
+                traffic->read(entry(name));
+            }
+        }
+        traffic_overflow_.read(snapshot.overflow);
+        // static topics are listed whether or not they saw traffic
+        for (std::size_t i = 0; i < Routes::size; ++i)
+        {
+            routes_[i].traffic.read(entry(Routes::names[i]));
+        }
+        {
+            std::shared_lock lk(shared_message_await_map_mutex_);
+            auto add = [&entry](std::string_view name, const SubscriberList<SharedMessageAwait<T>>& awaits) {
+                if (awaits.size() == 0) return;
+                TopicStats& stats = entry(name);
+                stats.shared_subscribers = awaits.size();
+                stats.shared_backlog = awaits.front()->queue_->size_approx();
+            };
+            for (auto& [name, awaits] : shared_message_await_map_)
+            {
+                add(name, awaits);
+            }
+            for (std::size_t i = 0; i < Routes::size; ++i)
+            {
+                add(Routes::names[i], routes_[i].shared.list);
+            }
         }
-        return r;
+        {
+            std::shared_lock lk(message_await_map_mutex_);
+            auto add = [&entry](std::string_view name, const SubscriberList<MessageAwait<T>>& awaits) {
+                if (awaits.size() == 0) return;
+                TopicStats& stats = entry(name);
+                stats.message_subscribers = awaits.size();
+                for (auto& await : awaits)
+                {
+                    stats.message_backlogs.push_back(await->queue_.size_approx());
+                    stats.slow_subscribers += await->slow() ? 1 : 0;
+                    stats.slow_drops += await->dropped_.load(std::memory_order_relaxed);
+                }
+            };
+            for (auto& [name, awaits] : message_await_map_)
+            {
+                add(name, awaits);
+            }
+            for (std::size_t i = 0; i < Routes::size; ++i)
+            {
+                add(Routes::names[i], routes_[i].message.list);
+            }
+        }
+        {
+            std::shared_lock lk(once_message_await_map_mutex_);
+            for (auto& [name, awaits] : once_message_await_map_)
+            {
+                if (awaits.size() == 0) continue;
+                entry(name).once_subscribers = awaits.size();
+            }
+            for (std::size_t i = 0; i < Routes::size; ++i)
+            {
+                if (routes_[i].once.list.size() == 0) continue;
+                entry(Routes::names[i]).once_subscribers = routes_[i].once.list.size();
+            }
+        }
+        snapshot.taken_at = std::chrono::steady_clock::now();
+        snapshot.topics.reserve(topics.size());
+        for (auto& [name, stats] : topics)
+        {
+            snapshot.topics.push_back(std::move(stats));
+        }
+        return snapshot;
+    }
+
+    // Dispatches one queued message on the calling thread; false if the queue was empty.
+    // For driving a bus without run(), e.g. as a step source of SimExecutor.
+    bool dispatch_one()
+    {
+        Envelope envelope;
+        if (poll(&envelope, 1) == 0)
+        {
+            return false;
+        }
+        dispatch(envelope);
+        return true;
     }
 
     void run()
@@ -396,9 +2698,15 @@ class MessageBus
         while (!stop_)
         {
             std::unique_lock lk(mutex_);
-            cv_.wait(lk, [this](){return queue_.size_approx() > 0 || stop_;});
+            cv_.wait(lk, [this](){return pending() || stop_;});
             lk.unlock();
             co_task.resume();
+            // queue is drained, hand batched payload frees back to the arena
+            MessageArena::instance().flush();
+            if (!accepting_)
+            {
+                notify_drain();
+            }
         }
     }
     void stop()
@@ -406,54 +2714,43 @@ class MessageBus
         stop_ = true;
         cv_.notify_all();
     }
+
+    // Refuses new publishes, waits for run() to dispatch what is already queued, then stops.
+    // Must be called from a thread other than the one inside run().
+    DrainReport drain(std::chrono::steady_clock::duration timeout)
+    {
+        DrainReport report;
+        accepting_ = false;
+        {
+            // once accepting_ is off, run() signals drain_cv_ whenever it runs dry and publishers
+            // signal it as they leave
+            std::unique_lock lk(mutex_);
+            report.completed = drain_cv_.wait_for(lk, timeout, [this]() {
+                return pushing_num_ == 0 && queue_.size_approx() == 0 && !lanes_busy() && suspend_co_num_ > 0;
+            });
+        }
+        stop();
+        report.dropped = queue_.size_approx();
+        std::lock_guard lk(lanes_mutex_);
+        for (auto& lane : lanes_)
+        {
+            report.dropped += lane->queue.size_approx();
+        }
+        return report;
+    }
     private:
     CoTask dispatch_message()
     {
+        Envelope batch[kDispatchBatch];
         while (!stop_) 
         {
-            T data;
-            bool r = queue_.try_dequeue(data);
-            if (r)
+            std::size_t n = poll(batch, kDispatchBatch);
+            if (n > 0)
             {
+                for (std::size_t i = 0; i < n; ++i)
                 {
-                    std::shared_lock lk(shared_message_await_map_mutex_);
-                    auto it = shared_message_await_map_.find(data.name);
-                    if (it != shared_message_await_map_.end() && it->second.size() > 0)
-                    {
-                        bool resume_one = false;
-                        for (auto& await : it->second)
-                        {
-                            if (resume_one = await->resume_one_coroutine(data) || resume_one; resume_one)
-                                break;;
-                        }
-                        if (!resume_one)
-                        {
-                            it->second.front()->push_message(data);
-                        }
-                    }
-                }
-                {
-                    std::shared_lock lk(message_await_map_mutex_);
-                    auto it = message_await_map_.find(data.name);
-                    if (it != message_await_map_.end() && it->second.size() > 0)
-                    {
-                        for (auto& await : it->second)
-                        {
-                            await->push_message(data);
-                        }
-                        
-                    }
-                }
-                {
-                    std::shared_lock lk(once_message_await_map_mutex_);
-                    auto it = once_message_await_map_.find(data.name);
-                    if (it != once_message_await_map_.end() && it->second.size() > 0)
-                    {
-                        for (auto& await : it->second)
-                        {
-                            await->push_message(data);
-                        }
-                    }
+                    Envelope envelope = std::move(batch[i]);
+                    dispatch(envelope);
                 }
             }else 
             {
@@ -465,17 +2762,497 @@ class MessageBus
     }
 
     private:
-    moodycamel::ConcurrentQueue<T> queue_;
+    // Dispatching thread only. It is the map's only writer, so it looks up without the lock and
+    // takes it just to insert; topic_stats() reads under the shared lock. Topics past
+    // kMaxTrafficTopics share one overflow entry, so a stream of distinct names can't grow it.
+    TopicTraffic& traffic(std::string_view name)
+    {
+        auto it = traffic_map_.find(name);
+        if (it != traffic_map_.end())
+        {
+            return *it->second;
+        }
+        if (traffic_map_.size() >= kMaxTrafficTopics)
+        {
+            return traffic_overflow_;
+        }
+        std::unique_lock lk(traffic_map_mutex_);
+        return *traffic_map_.emplace(std::string(name), std::make_unique<TopicTraffic>()).first->second;
+    }
+
+    // flow is the trace id given at publish, 0 when tracing was off; route is the 1-based
+    // StaticTopics slot of the topic, 0 for a topic that goes through the maps
+    struct Envelope
+    {
+        T data;
+        uint64_t flow = 0;
+        std::size_t route = 0;
+    };
+
+    // wraps messages into envelopes as enqueue_bulk walks them
+    struct EnvelopeIterator
+    {
+        T* data;
+        Envelope operator*() const
+        {
+            uint64_t flow = 0;
+            if (Tracer::enabled())
+            {
+                flow = Tracer::instance().new_flow();
+                Tracer::instance().record(TraceKind::Publish, flow, Tracer::instance().intern(data->name));
+            }
+            std::size_t route = Routes::route(data->name);
+            return {std::move(*data), flow, route};
+        }
+        EnvelopeIterator& operator++()
+        {
+            ++data;
+            return *this;
+        }
+        EnvelopeIterator operator++(int)
+        {
+            return {data++};
+        }
+    };
+
+    struct Lane
+    {
+        Lane(std::string name_, std::size_t capacity, int priority_):
+            queue(capacity),
+            name(std::move(name_)),
+            priority(priority_)
+        {
+        }
+        SpscRingQueue<Envelope> queue;
+        std::string name;
+        int priority;
+        alignas(64) std::atomic<bool> pushing = false;  // the lane's share of pushing_num_, for drain
+        std::atomic<bool> closed = false;               // its Publisher is gone
+    };
+    // a run of equal-priority entries in poll_lanes_ and where its round-robin resumes
+    struct PollLevel
+    {
+        std::size_t begin;
+        std::size_t end;
+        std::size_t next;
+    };
+
+    bool push_routed(T&& data, std::size_t route)
+    {
+        ++pushing_num_;
+        if (!accepting_)
+        {
+            leave_push();
+            return false;
+        }
+        uint64_t flow = 0;
+        if (Tracer::enabled())
+        {
+            flow = Tracer::instance().new_flow();
+            Tracer::instance().record(TraceKind::Publish, flow, Tracer::instance().intern(data.name));
+        }
+        Envelope envelope{std::move(data), flow, route};
+        bool r = queue_.enqueue(std::move(envelope));
+        if (!r)
+        {
+            data = std::move(envelope.data);
+        }
+        leave_push();
+        if (suspend_co_num_ > 0 && r)
+        {
+            wake_dispatcher();
+        }
+        return r;
+    }
+
+    bool push_lane(Lane& lane, T* data, std::size_t count)
+    {
+        lane.pushing.store(true);
+        if (!accepting_)
+        {
+            lane.pushing.store(false);
+            notify_drain();
+            return false;
+        }
+        lane.queue.enqueue_bulk(EnvelopeIterator{data}, count);
+        // seq_cst, so either the dispatcher sees the messages before it sleeps or we see it asleep
+        lane.pushing.store(false);
+        if (!accepting_)
+        {
+            notify_drain();
+        }
+        if (suspend_co_num_ > 0)
+        {
+            wake_dispatcher();
+        }
+        return true;
+    }
+
+    // taking mutex_ first means the notify can't fall between run()'s check and its wait
+    void wake_dispatcher()
+    {
+        {
+            std::lock_guard lk(mutex_);
+        }
+        cv_.notify_one();
+    }
+    void notify_drain()
+    {
+        {
+            std::lock_guard lk(mutex_);
+        }
+        drain_cv_.notify_all();
+    }
+    // a publisher that finished while drain() waits may have been the last thing it waited for
+    void leave_push()
+    {
+        --pushing_num_;
+        if (!accepting_)
+        {
+            notify_drain();
+        }
+    }
+
+    // Dispatching thread only: moves up to max envelopes from one source into batch, trying
+    // the highest priority first and rotating among equal priorities.
+    std::size_t poll(Envelope* batch, std::size_t max)
+    {
+        if (poll_levels_.empty() || poll_version_ != lanes_version_.load(std::memory_order_acquire))
+        {
+            refresh_poll();
+        }
+        for (PollLevel& level : poll_levels_)
+        {
+            std::size_t size = level.end - level.begin;
+            for (std::size_t i = 0; i < size; ++i)
+            {
+                std::size_t slot = (level.next + i) % size;
+                Lane* lane = poll_lanes_[level.begin + slot].get();
+                std::size_t n = lane ? lane->queue.try_dequeue_bulk(batch, max) : queue_.try_dequeue_bulk(batch, max);
+                if (n > 0)
+                {
+                    level.next = (slot + 1) % size;
+                    return n;
+                }
+                if (lane && lane->closed.load(std::memory_order_acquire) && lane->queue.size_approx() == 0)
+                {
+                    retire_lane(lane);
+                }
+            }
+        }
+        return 0;
+    }
+    // dispatching thread only
+    bool pending()
+    {
+        if (queue_.size_approx() > 0)
+        {
+            return true;
+        }
+        if (poll_version_ != lanes_version_.load(std::memory_order_acquire))
+        {
+            refresh_poll();
+        }
+        for (auto& lane : poll_lanes_)
+        {
+            if (lane && lane->queue.size_approx() > 0)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+    void refresh_poll()
+    {
+        std::lock_guard lk(lanes_mutex_);
+        poll_version_ = lanes_version_.load(std::memory_order_relaxed);
+        poll_lanes_.clear();
+        for (auto& lane : lanes_)
+        {
+            if (lane->priority <= 0 && (poll_lanes_.empty() || poll_lanes_.back()->priority > 0))
+            {
+                poll_lanes_.push_back(nullptr);
+            }
+            poll_lanes_.push_back(lane);
+        }
+        if (poll_lanes_.empty() || poll_lanes_.back()->priority > 0)
+        {
+            poll_lanes_.push_back(nullptr);
+        }
+        auto priority = [this](std::size_t i) { return poll_lanes_[i] ? poll_lanes_[i]->priority : 0; };
+        poll_levels_.clear();
+        for (std::size_t begin = 0; begin < poll_lanes_.size();)
+        {
+            std::size_t end = begin + 1;
+            while (end < poll_lanes_.size() && priority(end) == priority(begin))
+            {
+                ++end;
+            }
+            poll_levels_.push_back({begin, end, 0});
+            begin = end;
+        }
+    }
+    void retire_lane(Lane* lane)
+    {
+        std::lock_guard lk(lanes_mutex_);
+        auto it = std::find_if(lanes_.begin(), lanes_.end(), [lane](const auto& other) { return other.get() == lane; });
+        if (it != lanes_.end())
+        {
+            lanes_.erase(it);
+            lanes_version_.fetch_add(1, std::memory_order_release);
+        }
+    }
+    bool lanes_busy()
+    {
+        std::lock_guard lk(lanes_mutex_);
+        for (auto& lane : lanes_)
+        {
+            if (lane->pushing.load() || lane->queue.size_approx() > 0)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    using Routes = StaticTopics<T>;
+
+    // One await kind's subscribers of a static topic. list is guarded by the same mutex as
+    // that kind's map; size mirrors it so dispatch can skip the lock when there is nobody.
+    template<typename Await>
+    struct StaticSubscribers
+    {
+        SubscriberList<Await> list;
+        std::atomic<std::size_t> size = 0;
+    };
+    struct StaticRoute
+    {
+        StaticSubscribers<SharedMessageAwait<T>> shared;
+        StaticSubscribers<MessageAwait<T>> message;
+        StaticSubscribers<OnceMessageAwait<T>> once;
+        TopicTraffic traffic;
+    };
+
+    template<typename Await>
+    std::shared_mutex& subscriber_mutex()
+    {
+        if constexpr (AwaitTypeTraits<Await>::value == AwaitType::Shared) return shared_message_await_map_mutex_;
+        else if constexpr (AwaitTypeTraits<Await>::value == AwaitType::Normal) return message_await_map_mutex_;
+        else return once_message_await_map_mutex_;
+    }
+    template<typename Await>
+    auto& subscriber_map()
+    {
+        if constexpr (AwaitTypeTraits<Await>::value == AwaitType::Shared) return shared_message_await_map_;
+        else if constexpr (AwaitTypeTraits<Await>::value == AwaitType::Normal) return message_await_map_;
+        else return once_message_await_map_;
+    }
+    template<typename Await>
+    StaticSubscribers<Await>& static_subscribers(StaticRoute& route)
+    {
+        if constexpr (AwaitTypeTraits<Await>::value == AwaitType::Shared) return route.shared;
+        else if constexpr (AwaitTypeTraits<Await>::value == AwaitType::Normal) return route.message;
+        else return route.once;
+    }
+    // caller holds subscriber_mutex<Await>(); nullptr if the topic has no list
+    template<typename Await>
+    SubscriberList<Await>* find_subscribers(std::size_t route, std::string_view name)
+    {
+        if (route != 0)
+        {
+            return &static_subscribers<Await>(routes_[route - 1]).list;
+        }
+        auto& map = subscriber_map<Await>();
+        auto it = map.find(name);
+        return it == map.end() ? nullptr : &it->second;
+    }
+    // false only for a static topic without subscribers of this kind, taking no lock
+    template<typename Await>
+    bool may_have_subscribers(std::size_t route)
+    {
+        if constexpr (Routes::size == 0)
+        {
+            return true;
+        }else
+        {
+            return route == 0 || static_subscribers<Await>(routes_[route - 1]).size.load(std::memory_order_acquire) > 0;
+        }
+    }
+
+    void dispatch(Envelope& envelope)
+    {
+        T& data = envelope.data;
+        bool tracing = envelope.flow && Tracer::enabled();
+        if (tracing)
+        {
+            Tracer::current_flow() = envelope.flow;
+            Tracer::instance().record(TraceKind::DispatchBegin, envelope.flow, Tracer::instance().intern(data.name));
+        }
+        bool shared_fallback = false;
+        if (may_have_subscribers<SharedMessageAwait<T>>(envelope.route))
+        {
+            std::shared_lock lk(shared_message_await_map_mutex_);
+            auto awaits = find_subscribers<SharedMessageAwait<T>>(envelope.route, data.name);
+            if (awaits && awaits->size() > 0)
+            {
+                bool resume_one = false;
+                for (auto& await : *awaits)
+                {
+                    if (resume_one = await->resume_one_coroutine(data) || resume_one; resume_one)
+                        break;;
+                }
+                if (!resume_one)
+                {
+                    awaits->front()->push_message(data);
+                    shared_fallback = true;
+                }
+            }
+        }
+        std::size_t slow_flagged = 0;
+        if (may_have_subscribers<MessageAwait<T>>(envelope.route) || retention_num_.load(std::memory_order_relaxed) > 0)
+        {
+            std::shared_lock lk(message_await_map_mutex_);
+            auto awaits = find_subscribers<MessageAwait<T>>(envelope.route, data.name);
+            if (awaits && awaits->size() > 0)
+            {
+                for (auto& await : *awaits)
+                {
+                    bool flagged = false;
+                    await->push_message(data, flagged);
+                    slow_flagged += flagged ? 1 : 0;
+                }
+            }
+            // retained under the fan-out lock, so a snapshot subscriber sees each message exactly once
+            if (retention_num_.load(std::memory_order_relaxed) > 0)
+            {
+                std::lock_guard retention_lk(retention_mutex_);
+                auto retained = retention_map_.find(std::string_view(data.name));
+                if (retained != retention_map_.end())
+                {
+                    retained->second->add(data);
+                }
+            }
+        }
+        if (may_have_subscribers<OnceMessageAwait<T>>(envelope.route))
+        {
+            std::shared_lock lk(once_message_await_map_mutex_);
+            auto awaits = find_subscribers<OnceMessageAwait<T>>(envelope.route, data.name);
+            if (awaits && awaits->size() > 0)
+            {
+                for (auto& await : *awaits)
+                {
+                    await->push_message(data);
+                }
+            }
+        }
+        if (slow_flagged > 0 && slow_subscriber_policy_.on_slow)
+        {
+            for (std::size_t i = 0; i < slow_flagged; ++i)
+            {
+                slow_subscriber_policy_.on_slow(std::string_view(data.name), SlowSubscriberReason::Backlog);
+            }
+        }
+        TopicTraffic& counters = envelope.route ? routes_[envelope.route - 1].traffic : traffic(data.name);
+        counters.add(payload_bytes(data), shared_fallback);
+        if (tracing)
+        {
+            Tracer::current_flow() = 0;
+            Tracer::instance().record(TraceKind::DispatchEnd, envelope.flow);
+        }
+    }
+
+    static constexpr std::size_t kDispatchBatch = 32;
+
+    typename BusQueue<T>::template type<Envelope> queue_;
     std::mutex mutex_;
     std::condition_variable cv_;
+    std::condition_variable drain_cv_;
     std::atomic<uint16_t> suspend_co_num_ = 0;
+    std::atomic<uint32_t> pushing_num_ = 0;
+    std::atomic<bool> accepting_ = true;
     std::atomic<bool> stop_ = false;
     std::shared_mutex shared_message_await_map_mutex_;
-    std::unordered_map<std::string, std::list<SharedMessageAwait<T>*>> shared_message_await_map_;
+    std::unordered_map<std::string, SubscriberList<SharedMessageAwait<T>>, TopicHash, std::equal_to<>> shared_message_await_map_;
     std::shared_mutex message_await_map_mutex_;
-    std::unordered_map<std::string, std::list<MessageAwait<T>*>> message_await_map_;
+    std::unordered_map<std::string, SubscriberList<MessageAwait<T>>, TopicHash, std::equal_to<>> message_await_map_;
     std::shared_mutex once_message_await_map_mutex_;
-    std::unordered_map<std::string, std::list<OnceMessageAwait<T>*>> once_message_await_map_;
+    std::unordered_map<std::string, SubscriberList<OnceMessageAwait<T>>, TopicHash, std::equal_to<>> once_message_await_map_;
+    SlowSubscriberPolicy slow_subscriber_policy_;
+    std::shared_mutex traffic_map_mutex_;
+    std::unordered_map<std::string, std::unique_ptr<TopicTraffic>, TopicHash, std::equal_to<>> traffic_map_;
+    TopicTraffic traffic_overflow_;
+    std::mutex retention_mutex_;
+    std::unordered_map<std::string, std::unique_ptr<RetainedTopic<T>>, TopicHash, std::equal_to<>> retention_map_;
+    std::atomic<std::size_t> retention_num_ = 0;
+    std::array<StaticRoute, Routes::size> routes_;
+    std::mutex lanes_mutex_;
+    std::vector<std::shared_ptr<Lane>> lanes_;      // by priority, highest first
+    std::atomic<uint64_t> lanes_version_ = 0;
+    // the dispatching thread's copy of lanes_ with queue_ slotted in at priority 0
+    std::vector<std::shared_ptr<Lane>> poll_lanes_;
+    std::vector<PollLevel> poll_levels_;
+    uint64_t poll_version_ = 0;
+};
+
+// A publishing thread's lane into a MessageBus, from register_publisher. Move-only, pushed to by
+// one thread at a time. Dropping it closes the lane; the dispatcher still takes what's queued.
+template<typename T>
+class MessageBus<T>::Publisher
+{
+    public:
+    Publisher() = default;
+    Publisher(Publisher&& other) noexcept = default;
+    Publisher& operator=(Publisher&& other) noexcept
+    {
+        if (this != &other)
+        {
+            close();
+            message_bus_ = other.message_bus_;
+            lane_ = std::move(other.lane_);
+        }
+        return *this;
+    }
+    ~Publisher()
+    {
+        close();
+    }
+
+    bool push_message(T&& data)
+    {
+        return message_bus_->push_lane(*lane_, &data, 1);
+    }
+    // moves count messages in with one publish of the lane's tail
+    bool push_messages(T* data, std::size_t count)
+    {
+        return message_bus_->push_lane(*lane_, data, count);
+    }
+    std::size_t backlog() const
+    {
+        return lane_ ? lane_->queue.size_approx() : 0;
+    }
+    explicit operator bool() const
+    {
+        return lane_ != nullptr;
+    }
+
+    private:
+    friend class MessageBus<T>;
+    Publisher(MessageBus<T>* message_bus, std::shared_ptr<Lane> lane):
+        message_bus_(message_bus),
+        lane_(std::move(lane))
+    {
+    }
+    void close()
+    {
+        if (lane_)
+        {
+            lane_->closed.store(true, std::memory_order_release);
+            lane_.reset();
+        }
+    }
+
+    MessageBus<T>* message_bus_ = nullptr;
+    std::shared_ptr<Lane> lane_;
 };
 
 
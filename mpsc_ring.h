@@ -0,0 +1,126 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+
+// Bounded ring for many producers and exactly one consumer, with the subset of the
+// moodycamel::ConcurrentQueue interface MessageBus uses, so it can stand in as the bus's central
+// queue (see BusQueue). Producers claim a run of slots with one CAS on tail and publish each
+// slot through its sequence; the consumer takes every published slot in order and moves head
+// once per batch. A full ring makes enqueue fail, items untouched, instead of growing, so
+// publishers get backpressure rather than unbounded memory; it doesn't wait either, the
+// publisher may be the very thread that would dispatch (SimExecutor). A producer preempted
+// between claim and publish holds back the slots behind it until it resumes.
+template<typename E, std::size_t Capacity = 16384>
+class MpscRingQueue
+{
+    static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "ring capacity must be a power of two");
+
+    public:
+    MpscRingQueue():
+        slots_(std::make_unique<Slot[]>(Capacity))
+    {
+    }
+    MpscRingQueue(const MpscRingQueue&) = delete;
+    MpscRingQueue& operator=(const MpscRingQueue&) = delete;
+
+    // false if the ring is full, item is then left as it was
+    bool enqueue(E&& item)
+    {
+        E* first = &item;
+        return claim(first, 1);
+    }
+    // moves all count items out of the range, or none and returns false if fewer slots are free
+    template<typename It>
+    bool enqueue_bulk(It first, std::size_t count)
+    {
+        return count == 0 || claim(first, count);
+    }
+    bool try_enqueue(E&& item)
+    {
+        return enqueue(std::move(item));
+    }
+
+    // consumer only
+    bool try_dequeue(E& item)
+    {
+        return try_dequeue_bulk(&item, 1) == 1;
+    }
+    // consumer only; moves up to max published items out in order
+    template<typename It>
+    std::size_t try_dequeue_bulk(It out, std::size_t max)
+    {
+        uint64_t head = head_.load(std::memory_order_relaxed);
+        std::size_t n = 0;
+        while (n < max)
+        {
+            Slot& slot = slots_[(head + n) & kMask];
+            if (slot.sequence.load(std::memory_order_acquire) != head + n + 1)
+            {
+                break;
+            }
+            *out = std::move(slot.value);
+            ++out;
+            ++n;
+        }
+        if (n > 0)
+        {
+            head_.store(head + n, std::memory_order_release);
+        }
+        return n;
+    }
+
+    // claimed slots count as queued even before their producer publishes them
+    std::size_t size_approx() const
+    {
+        uint64_t head = head_.load(std::memory_order_relaxed);
+        uint64_t tail = tail_.load(std::memory_order_relaxed);
+        return tail > head ? static_cast<std::size_t>(tail - head) : 0;
+    }
+    static constexpr std::size_t capacity()
+    {
+        return Capacity;
+    }
+
+    private:
+    static constexpr uint64_t kMask = Capacity - 1;
+
+    // sequence == position + 1 once the slot holds the item for that position; positions never
+    // repeat, so a slot needs no reset after it's consumed
+    struct Slot
+    {
+        std::atomic<uint64_t> sequence{0};
+        E value{};
+    };
+
+    // claims and publishes all count slots, or returns false without touching the items
+    template<typename It>
+    bool claim(It& first, std::size_t count)
+    {
+        uint64_t tail = tail_.load(std::memory_order_relaxed);
+        do
+        {
+            // acquire pairs with the consumer's head store, so the slots below head are moved out
+            uint64_t head = head_.load(std::memory_order_acquire);
+            if (Capacity - static_cast<std::size_t>(tail - head) < count)
+            {
+                return false;
+            }
+        }while (!tail_.compare_exchange_weak(tail, tail + count, std::memory_order_relaxed));
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            Slot& slot = slots_[(tail + i) & kMask];
+            slot.value = std::move(*first);
+            ++first;
+            slot.sequence.store(tail + i + 1, std::memory_order_release);
+        }
+        return true;
+    }
+
+    alignas(64) std::atomic<uint64_t> tail_{0};
+    alignas(64) std::atomic<uint64_t> head_{0};
+    alignas(64) std::unique_ptr<Slot[]> slots_;
+};
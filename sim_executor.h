@@ -0,0 +1,173 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <random>
+#include <vector>
+#include "messagebus.h"
+
+
+// Single-threaded stand-in for CoExecutor that makes every scheduling decision from a seed.
+// Awaits take it wherever they take a CoExecutor; it never starts workers. Resumes are
+// collected instead of queued, and each step() picks at random between running one of them
+// (in any order, priorities included), calling one of the step sources (a bus's
+// dispatch_one, a producer), and jumping the virtual clock to the next timer. A schedule is
+// thus a pure function of the seed, so a failure found by exploring many seeds replays
+// exactly from its seed.
+//     auto failing = SimExecutor::explore(0, 10000, [](SimExecutor& sim) {
+//         MessageBus<TestMessage> bus;
+//         sim.add_source([&bus] { return bus.dispatch_one(); });
+//         ... spawn coroutines on &sim, sim.run(), return whether invariants hold
+//     });
+class SimExecutor : public CoExecutor
+{
+    public:
+    explicit SimExecutor(uint64_t seed):
+        CoExecutor(1),
+        seed_(seed),
+        random_(seed)
+    {
+        simulated_ = true;
+    }
+    SimExecutor(const SimExecutor&) = delete;
+    SimExecutor& operator=(const SimExecutor&) = delete;
+
+    // step returns false when it had nothing to do, the simulation then tries something else
+    void add_source(std::function<bool()> step)
+    {
+        sources_.push_back(std::move(step));
+    }
+
+    // Runs one step; false once nothing is runnable, no source has work and no timer is pending.
+    bool step()
+    {
+        collect_fired();
+        std::size_t timer = timers_.empty() ? 0 : 1;
+        std::size_t candidate_num = sim_ready_.size() + sources_.size() + timer;
+        if (candidate_num == 0)
+        {
+            return false;
+        }
+        // sources may be idle, so walk the candidates from a random start until one does something
+        std::size_t first = std::uniform_int_distribution<std::size_t>(0, candidate_num - 1)(random_);
+        for (std::size_t i = 0; i < candidate_num; ++i)
+        {
+            std::size_t pick = (first + i) % candidate_num;
+            if (pick < sim_ready_.size())
+            {
+                resume(pick);
+                return true;
+            }
+            pick -= sim_ready_.size();
+            if (pick < sources_.size())
+            {
+                if (sources_[pick]())
+                {
+                    ++steps_;
+                    return true;
+                }
+                continue;
+            }
+            advance_to_next_timer();
+            return true;
+        }
+        return false;
+    }
+
+    // steps until quiescent or max_steps; returns the number of steps taken
+    uint64_t run(uint64_t max_steps = UINT64_MAX)
+    {
+        uint64_t begin = steps_;
+        while (steps_ - begin < max_steps && step())
+        {
+        }
+        return steps_ - begin;
+    }
+
+    uint64_t seed() const
+    {
+        return seed_;
+    }
+    uint64_t steps() const
+    {
+        return steps_;
+    }
+    std::chrono::steady_clock::time_point now() const
+    {
+        return sim_now_;
+    }
+    // coroutines scheduled and not yet run
+    std::size_t ready() const
+    {
+        return sim_ready_.size();
+    }
+
+    // Runs scenario on a fresh SimExecutor for each seed in [first_seed, first_seed + count) and
+    // returns the first seed it reported false for. Objects the scenario creates must live inside
+    // it, so each schedule starts from scratch.
+    static std::optional<uint64_t> explore(uint64_t first_seed, uint64_t count, const std::function<bool(SimExecutor&)>& scenario)
+    {
+        for (uint64_t seed = first_seed; seed < first_seed + count; ++seed)
+        {
+            SimExecutor sim(seed);
+            if (!scenario(sim))
+            {
+                return seed;
+            }
+        }
+        return std::nullopt;
+    }
+
+    private:
+    void resume(std::size_t index)
+    {
+        auto handle = sim_ready_[index];
+        sim_ready_[index] = sim_ready_.back();
+        sim_ready_.pop_back();
+        ++steps_;
+        // the frame may be gone once resume returns, so note the strand we run under now
+        Strand* strand = handle.promise().strand_;
+        handle.resume();
+        if (strand)
+        {
+            release_strand(strand);
+        }
+    }
+
+    void advance_to_next_timer()
+    {
+        std::unique_lock lk(mutex_);
+        if (!timers_.empty() && timers_.begin()->first > sim_now_)
+        {
+            sim_now_ = timers_.begin()->first;
+        }
+        lk.unlock();
+        ++steps_;
+        collect_fired();
+    }
+
+    // timers fire into the executor's queue; move them over to the simulated ready set
+    void collect_fired()
+    {
+        std::vector<coroutine_handle<CoTask::promise_type>> strand_fired;
+        {
+            std::lock_guard lk(mutex_);
+            fire_timers(sim_now_);
+            while (!queue_.empty())
+            {
+                sim_ready_.push_back(queue_.top().handle);
+                queue_.pop();
+            }
+            strand_fired.swap(strand_fired_);
+        }
+        for (auto& handle : strand_fired)
+        {
+            schedule_coroutine(handle);
+        }
+    }
+
+    uint64_t seed_;
+    std::mt19937_64 random_;
+    std::vector<std::function<bool()>> sources_;
+    uint64_t steps_ = 0;
+};
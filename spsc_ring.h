@@ -0,0 +1,123 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <thread>
+
+
+// Bounded ring for exactly one producer and one consumer. Each side owns its index on its own
+// cache line and keeps a cached copy of the other's, so in steady state a push or pop touches
+// no line the other thread writes except the slots themselves. Bulk calls publish a whole run
+// with one index store. Capacity is rounded up to a power of two.
+template<typename E>
+class SpscRingQueue
+{
+    public:
+    explicit SpscRingQueue(std::size_t capacity):
+        capacity_(std::bit_ceil(std::max<std::size_t>(capacity, 2))),
+        mask_(capacity_ - 1),
+        slots_(std::make_unique<E[]>(capacity_))
+    {
+    }
+    SpscRingQueue(const SpscRingQueue&) = delete;
+    SpscRingQueue& operator=(const SpscRingQueue&) = delete;
+
+    // producer only; false if the ring is full
+    bool try_enqueue(E&& item)
+    {
+        E* first = &item;
+        return try_enqueue_bulk(first, 1) == 1;
+    }
+    // producer only; moves as many of count items in as fit and returns how many
+    template<typename It>
+    std::size_t try_enqueue_bulk(It& first, std::size_t count)
+    {
+        uint64_t tail = tail_.load(std::memory_order_relaxed);
+        if (capacity_ - (tail - head_cache_) < count)
+        {
+            head_cache_ = head_.load(std::memory_order_acquire);
+        }
+        std::size_t n = std::min<std::size_t>(count, capacity_ - (tail - head_cache_));
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            slots_[(tail + i) & mask_] = std::move(*first);
+            ++first;
+        }
+        if (n > 0)
+        {
+            tail_.store(tail + n, std::memory_order_release);
+        }
+        return n;
+    }
+    // producer only; waits while the ring is full
+    template<typename It>
+    void enqueue_bulk(It first, std::size_t count)
+    {
+        while (count > 0)
+        {
+            std::size_t n = try_enqueue_bulk(first, count);
+            if (n == 0)
+            {
+                full_waits_.store(full_waits_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+                std::this_thread::yield();
+            }
+            count -= n;
+        }
+    }
+
+    // consumer only
+    template<typename It>
+    std::size_t try_dequeue_bulk(It out, std::size_t max)
+    {
+        uint64_t head = head_.load(std::memory_order_relaxed);
+        if (tail_cache_ - head < max)
+        {
+            tail_cache_ = tail_.load(std::memory_order_acquire);
+        }
+        std::size_t n = std::min<std::size_t>(max, tail_cache_ - head);
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            *out = std::move(slots_[(head + i) & mask_]);
+            ++out;
+        }
+        if (n > 0)
+        {
+            head_.store(head + n, std::memory_order_release);
+        }
+        return n;
+    }
+
+    std::size_t size_approx() const
+    {
+        uint64_t head = head_.load(std::memory_order_relaxed);
+        uint64_t tail = tail_.load(std::memory_order_relaxed);
+        return tail > head ? static_cast<std::size_t>(tail - head) : 0;
+    }
+    std::size_t capacity() const
+    {
+        return capacity_;
+    }
+    // items pushed so far; read from any thread
+    uint64_t pushed() const
+    {
+        return tail_.load(std::memory_order_relaxed);
+    }
+    // times enqueue_bulk found the ring full and had to wait for the consumer
+    uint64_t full_waits() const
+    {
+        return full_waits_.load(std::memory_order_relaxed);
+    }
+
+    private:
+    const std::size_t capacity_;
+    const std::size_t mask_;
+    std::unique_ptr<E[]> slots_;
+    alignas(64) std::atomic<uint64_t> tail_{0};
+    uint64_t head_cache_ = 0;
+    std::atomic<uint64_t> full_waits_{0};
+    alignas(64) std::atomic<uint64_t> head_{0};
+    uint64_t tail_cache_ = 0;
+};
@@ -0,0 +1,318 @@
+#include "bus_bridge.h"
+#include "sanitizer_options.h"
+#include <csignal>
+#include <cstring>
+#include <iostream>
+#include <pthread.h>
+
+
+// Loopback run of BusBridgeSender/BusBridgeReceiver, over a Unix socket and over TCP. Messages
+// published on one bus are forwarded to a second bus in the same process, and the run checks:
+//   - every message of every topic arrives exactly once and in publish order, and the sender
+//     and receiver counts agree with it
+//   - partial writes are resumed correctly: the send buffer is shrunk and SIGUSR1 keeps
+//     interrupting the blocked writer, so sends come back short; at least one must
+//   - a message over the frame limits, a topic name past 64K or a payload past 16M, is dropped
+//     and counted by the sender and the connection carries on
+//   - a peer disconnect is noticed: once the receiving end closes, the sender reports failed
+//     (and the process survives it), and once the sending end closes, the receiver finishes
+// Exits non-zero on the first violated check.
+//
+//   bridge_loopback [messages per topic] [topics] [threads]
+
+struct Config
+{
+    uint32_t messages = 20000;
+    uint32_t topics = 4;
+    int threads = 2;
+    std::size_t max_payload = 2048;
+};
+
+struct Failure
+{
+    std::atomic<bool> failed{false};
+    std::mutex mutex;
+    std::string first;
+
+    void report(const std::string& what)
+    {
+        std::lock_guard lk(mutex);
+        if (!failed.exchange(true))
+        {
+            first = what;
+        }
+    }
+};
+
+// one per topic on the receiving bus; only its own coroutine touches next
+struct OrderedSubscriber
+{
+    uint32_t next = 0;
+    std::atomic<uint64_t> received{0};
+};
+
+static TestMessage make_message(const std::string& topic, uint32_t seq, std::size_t max_payload)
+{
+    TestMessage msg;
+    msg.name = topic;
+    std::size_t size = sizeof(seq) + seq * 37 % max_payload;
+    msg.data.assign(size, static_cast<char>('a' + seq % 26));
+    std::memcpy(msg.data.data(), &seq, sizeof(seq));
+    return msg;
+}
+
+CoTask ordered(MessageBus<TestMessage>* message_bus, CoExecutor* co_executor, std::string topic,
+    OrderedSubscriber* subscriber, CancellationToken token, std::size_t max_payload, Failure* failure)
+{
+    auto await = message_bus->create_message_await(co_executor, topic);
+    await.set_cancellation_token(token);
+    while (true)
+    {
+        TestMessage msg = co_await await;
+        if (await.cancelled()) break;
+        uint32_t seq = 0;
+        if (msg.data.size() >= sizeof(seq))
+        {
+            std::memcpy(&seq, msg.data.data(), sizeof(seq));
+        }
+        if (seq != subscriber->next || msg.data != make_message(topic, seq, max_payload).data)
+        {
+            failure->report(topic + ": expected seq " + std::to_string(subscriber->next) + " got " + std::to_string(seq));
+        }
+        subscriber->next = seq + 1;
+        subscriber->received.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+static void on_interrupt(int)
+{
+}
+
+template<typename F>
+static bool wait_for(F&& done, std::chrono::steady_clock::duration timeout)
+{
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (!done())
+    {
+        if (std::chrono::steady_clock::now() >= deadline)
+        {
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return true;
+}
+
+// a small send buffer keeps the writer blocked in sendmsg, where SIGUSR1 cuts sends short; the
+// receive side is left alone, a TCP window below half the loopback MSS only moves on probes
+static void shrink_send_buffer(int fd)
+{
+    int size = 65536;
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+}
+
+// a connected pair through listen_fd, first the sending end
+template<typename Connect>
+static std::pair<int, int> connect_pair(int listen_fd, Connect&& connect)
+{
+    int send_fd = connect();
+    int receive_fd = send_fd < 0 ? -1 : bridge_accept(listen_fd);
+    if (send_fd < 0 || receive_fd < 0)
+    {
+        std::cout << "FAILED: connect: " << std::strerror(errno) << std::endl;
+        std::exit(1);
+    }
+    shrink_send_buffer(send_fd);
+    return {send_fd, receive_fd};
+}
+
+// listen_fd is a listening socket the run closes, connect opens a client end to it
+template<typename Connect>
+static bool run(const std::string& transport, const Config& config, int listen_fd, Connect&& connect)
+{
+    std::cout << transport << ": " << config.topics << " topics x " << config.messages << " messages, "
+        << config.threads << " threads" << std::endl;
+    if (listen_fd < 0)
+    {
+        std::cout << "FAILED: " << transport << " listen: " << std::strerror(errno) << std::endl;
+        return false;
+    }
+    Failure failure;
+    MessageBus<TestMessage> source;
+    MessageBus<TestMessage> sink;
+    CoExecutor co_executor(config.threads);
+    co_executor.start();
+    CancellationSource cancel;
+
+    std::vector<std::string> topics;
+    std::vector<std::unique_ptr<OrderedSubscriber>> subscribers;
+    for (uint32_t t = 0; t < config.topics; ++t)
+    {
+        topics.push_back("bridge" + std::to_string(t));
+        subscribers.push_back(std::make_unique<OrderedSubscriber>());
+        ordered(&sink, &co_executor, topics.back(), subscribers.back().get(), cancel.token(), config.max_payload, &failure);
+    }
+    std::thread source_dispatcher([&source](){ source.run(); });
+    std::thread sink_dispatcher([&sink](){ sink.run(); });
+
+    auto [send_fd, receive_fd] = connect_pair(listen_fd, connect);
+    auto receiver = std::make_unique<BusBridgeReceiver<TestMessage>>(&sink, receive_fd);
+    receiver->start();
+    auto sender = std::make_unique<BusBridgeSender<TestMessage>>(&source, &co_executor, send_fd, topics);
+    // SIGUSR1 is blocked everywhere but in the sender's writer thread, which inherits this mask
+    sigset_t interrupt;
+    sigemptyset(&interrupt);
+    sigaddset(&interrupt, SIGUSR1);
+    pthread_sigmask(SIG_UNBLOCK, &interrupt, nullptr);
+    sender->start();
+    pthread_sigmask(SIG_BLOCK, &interrupt, nullptr);
+
+    std::atomic<bool> interrupting{true};
+    std::thread interrupter([&interrupting]()
+    {
+        while (interrupting)
+        {
+            kill(getpid(), SIGUSR1);
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    });
+    auto begin = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < config.messages; ++i)
+    {
+        for (const auto& topic : topics)
+        {
+            source.push_message(make_message(topic, i, config.max_payload));
+        }
+    }
+    auto delivered = [&]() {
+        for (auto& subscriber : subscribers)
+        {
+            if (subscriber->received.load() < config.messages) return false;
+        }
+        return true;
+    };
+    if (!wait_for([&]() { return delivered() || failure.failed; }, std::chrono::seconds(60)))
+    {
+        failure.report("timed out waiting for delivery");
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    interrupting = false;
+    interrupter.join();
+
+    // let anything still in flight land, so a duplicate is caught
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    uint64_t expected = static_cast<uint64_t>(config.messages) * config.topics;
+    for (std::size_t t = 0; t < topics.size(); ++t)
+    {
+        if (subscribers[t]->received.load() != config.messages)
+        {
+            failure.report(topics[t] + ": received " + std::to_string(subscribers[t]->received.load()) + " of " +
+                std::to_string(config.messages));
+        }
+    }
+    BridgeStats sent = sender->stats();
+    BridgeStats received = receiver->stats();
+    if (sent.messages != expected || received.messages != expected || sent.failed || received.failed)
+    {
+        failure.report("bridge stats: sent " + std::to_string(sent.messages) + ", received " +
+            std::to_string(received.messages) + " of " + std::to_string(expected));
+    }
+    if (sent.partial_writes == 0)
+    {
+        failure.report("no send came back short, the resume path went untested");
+    }
+
+    // receiving end goes away: the sender must notice instead of blocking or taking SIGPIPE
+    receiver.reset();
+    if (!wait_for([&]() {
+            source.push_message(make_message(topics[0], 0, config.max_payload));
+            return sender->stats().failed;
+        }, std::chrono::seconds(10)))
+    {
+        failure.report("sender did not notice the receiver disconnect");
+    }
+    sender.reset();
+
+    // sending end goes away: the receiver finishes, and not because of a bad frame; an oversized
+    // name and payload go first, they must be dropped without taking the connection down
+    std::tie(send_fd, receive_fd) = connect_pair(listen_fd, connect);
+    receiver = std::make_unique<BusBridgeReceiver<TestMessage>>(&sink, receive_fd);
+    receiver->start();
+    std::string long_topic(bridge_frame::kMaxName + 1, 'n');
+    sender = std::make_unique<BusBridgeSender<TestMessage>>(&source, &co_executor, send_fd,
+        std::vector<std::string>{"bridge.disconnect", long_topic});
+    sender->start();
+    TestMessage long_name;
+    long_name.name = long_topic;
+    source.push_message(std::move(long_name));
+    TestMessage large;
+    large.name = "bridge.disconnect";
+    large.data.assign(bridge_frame::kMaxPayload, 'l');
+    source.push_message(std::move(large));
+    for (uint32_t i = 0; i < 100; ++i)
+    {
+        source.push_message(make_message("bridge.disconnect", i, config.max_payload));
+    }
+    if (!wait_for([&]() { return receiver->stats().messages == 100; }, std::chrono::seconds(10)))
+    {
+        failure.report("disconnect run: received " + std::to_string(receiver->stats().messages) + " of 100");
+    }
+    if (sender->stats().oversized != 2 || sender->stats().messages != 100 || receiver->stats().failed)
+    {
+        failure.report("oversized messages: " + std::to_string(sender->stats().oversized) + " dropped, " +
+            std::to_string(sender->stats().messages) + " sent");
+    }
+    sender.reset();
+    if (!wait_for([&]() { return receiver->finished(); }, std::chrono::seconds(10)) || receiver->stats().failed)
+    {
+        failure.report("receiver did not finish cleanly after the sender disconnect");
+    }
+    receiver.reset();
+    close(listen_fd);
+
+    cancel.cancel();
+    source.stop();
+    sink.stop();
+    source_dispatcher.join();
+    sink_dispatcher.join();
+    co_executor.drain(std::chrono::seconds(5));
+
+    if (failure.failed)
+    {
+        std::cout << "FAILED: " << transport << ": " << failure.first << std::endl;
+        return false;
+    }
+    std::cout << "ok: " << expected << " messages in " << seconds << "s, " << sent.syscalls << " sends ("
+        << sent.partial_writes << " short), " << received.syscalls << " reads" << std::endl;
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    Config config;
+    if (argc > 1) config.messages = static_cast<uint32_t>(std::atoi(argv[1]));
+    if (argc > 2) config.topics = static_cast<uint32_t>(std::atoi(argv[2]));
+    if (argc > 3) config.threads = std::atoi(argv[3]);
+
+    // no SA_RESTART, so a send blocked on a full buffer returns short or with EINTR
+    struct sigaction action{};
+    action.sa_handler = on_interrupt;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGUSR1, &action, nullptr);
+    sigset_t interrupt;
+    sigemptyset(&interrupt);
+    sigaddset(&interrupt, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &interrupt, nullptr);
+
+    std::string path = "/tmp/bridge_loopback." + std::to_string(getpid()) + ".sock";
+    bool ok = run("unix", config, bridge_listen_unix(path), [&path]() { return bridge_connect_unix(path); });
+    unlink(path.c_str());
+
+    int listen_fd = bridge_listen_tcp(0);
+    sockaddr_in addr{};
+    socklen_t addr_size = sizeof(addr);
+    getsockname(listen_fd, reinterpret_cast<sockaddr*>(&addr), &addr_size);
+    uint16_t port = ntohs(addr.sin_port);
+    ok = run("tcp", config, listen_fd, [port]() { return bridge_connect_tcp("127.0.0.1", port); }) && ok;
+    return ok ? 0 : 1;
+}
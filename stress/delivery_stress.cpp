@@ -0,0 +1,316 @@
+#include "messagebus.h"
+#include "sanitizer_options.h"
+#include <cstring>
+#include <iostream>
+#include <memory>
+
+
+// Delivery guarantee stress run. Producer threads publish sequenced messages as fast as they
+// can over many topics while every subscriber kind listens, then the run checks:
+//   - each MessageAwait (single and batch receive) got every message of every producer
+//     exactly once and in publish order
+//   - each SharedMessageAwait group got every message exactly once across its members
+//   - every OnceMessageAwait got the message published right after it was created, even
+//     when that message was dispatched before the coroutine reached co_await
+// With lanes on, each producer publishes through its own register_publisher lane.
+// Exits non-zero on the first violated guarantee. Build with -DMESSAGE_BUS_SANITIZER=thread
+// or =address to run the same load under a sanitizer; the first sanitizer report then ends the
+// run with a non-zero status (see sanitizer_options.h) instead of letting it print "ok".
+//
+//   delivery_stress [messages per producer] [producers] [topics] [threads] [affinity 0/1] [lanes 0/1]
+
+struct Payload
+{
+    uint32_t producer;
+    uint32_t seq;
+};
+
+static Payload decode(const TestMessage& msg)
+{
+    Payload payload;
+    std::memcpy(&payload, msg.data.data(), sizeof(payload));
+    return payload;
+}
+
+struct Config
+{
+    uint32_t messages = 20000;
+    uint32_t producers = 4;
+    uint32_t topics = 8;
+    int threads = 4;
+    bool affinity = false;
+    bool lanes = false;
+    uint32_t message_subscribers = 2;   // per topic, one of them receives in batches
+    uint32_t shared_members = 3;        // per topic
+    uint32_t once_rounds = 200;         // per topic
+};
+
+struct Failure
+{
+    std::atomic<bool> failed{false};
+    std::mutex mutex;
+    std::string first;
+
+    void report(const std::string& what)
+    {
+        std::lock_guard lk(mutex);
+        if (!failed.exchange(true))
+        {
+            first = what;
+        }
+    }
+};
+
+// one per MessageAwait subscriber; only its own coroutine touches next
+struct OrderedSubscriber
+{
+    std::vector<uint32_t> next;
+    std::atomic<uint64_t> received{0};
+};
+
+static void check_ordered(OrderedSubscriber* subscriber, const TestMessage& msg, Failure* failure)
+{
+    Payload payload = decode(msg);
+    uint32_t& next = subscriber->next[payload.producer];
+    if (payload.seq != next)
+    {
+        failure->report(msg.name + ": producer " + std::to_string(payload.producer) + " expected seq " +
+            std::to_string(next) + " got " + std::to_string(payload.seq));
+    }
+    next = payload.seq + 1;
+    subscriber->received.fetch_add(1, std::memory_order_relaxed);
+}
+
+CoTask ordered(MessageBus<TestMessage>* message_bus, CoExecutor* co_executor, std::string topic,
+    OrderedSubscriber* subscriber, CancellationToken token, Failure* failure)
+{
+    auto await = message_bus->create_message_await(co_executor, topic);
+    await.set_cancellation_token(token);
+    while (true)
+    {
+        TestMessage msg = co_await await;
+        if (await.cancelled()) break;
+        check_ordered(subscriber, msg, failure);
+    }
+}
+
+CoTask ordered_batch(MessageBus<TestMessage>* message_bus, CoExecutor* co_executor, std::string topic,
+    OrderedSubscriber* subscriber, CancellationToken token, Failure* failure)
+{
+    auto await = message_bus->create_message_await(co_executor, topic);
+    await.set_cancellation_token(token);
+    TestMessage batch[32];
+    while (true)
+    {
+        std::size_t n = co_await await.next_batch(batch, 32);
+        if (await.cancelled()) break;
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            check_ordered(subscriber, batch[i], failure);
+        }
+    }
+}
+
+// delivery count per (producer, seq) of one topic, shared by the members of its group
+struct SharedGroup
+{
+    SharedGroup(uint32_t producers, uint32_t messages):
+        messages(messages),
+        seen(std::make_unique<std::atomic<uint8_t>[]>(static_cast<std::size_t>(producers) * messages))
+    {
+    }
+    uint32_t messages;
+    std::unique_ptr<std::atomic<uint8_t>[]> seen;
+    std::atomic<uint64_t> received{0};
+};
+
+CoTask shared_member(MessageBus<TestMessage>* message_bus, CoExecutor* co_executor, std::string topic,
+    SharedGroup* group, CancellationToken token, Failure* failure)
+{
+    auto await = message_bus->create_shared_message_await(co_executor, topic);
+    await.set_cancellation_token(token);
+    while (true)
+    {
+        TestMessage msg = co_await await;
+        if (await.cancelled()) break;
+        Payload payload = decode(msg);
+        if (group->seen[static_cast<std::size_t>(payload.producer) * group->messages + payload.seq].fetch_add(1) != 0)
+        {
+            failure->report(topic + ": shared group got producer " + std::to_string(payload.producer) + " seq " +
+                std::to_string(payload.seq) + " twice");
+        }
+        group->received.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+// creates a once await, publishes a single message to it and expects exactly that one back;
+// a drop shows up as the timer winning
+CoTask once_checker(MessageBus<TestMessage>* message_bus, CoExecutor* co_executor, std::string topic,
+    uint32_t rounds, std::atomic<uint32_t>* completed, Failure* failure)
+{
+    for (uint32_t round = 0; round < rounds && !failure->failed; ++round)
+    {
+        auto once = message_bus->create_once_message_await(co_executor, topic);
+        auto timer = co_executor->create_timer_await(std::chrono::seconds(30));
+        TestMessage msg;
+        msg.name = topic;
+        Payload payload{0, round};
+        msg.data.assign(reinterpret_cast<const char*>(&payload), sizeof(payload));
+        message_bus->push_message(std::move(msg));
+        if (co_await when_any(once, timer) != 0)
+        {
+            failure->report(topic + ": once await dropped round " + std::to_string(round));
+            break;
+        }
+        if (decode(once.take()).seq != round)
+        {
+            failure->report(topic + ": once await got a stale message in round " + std::to_string(round));
+            break;
+        }
+        completed->fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    Config config;
+    if (argc > 1) config.messages = static_cast<uint32_t>(std::atoi(argv[1]));
+    if (argc > 2) config.producers = static_cast<uint32_t>(std::atoi(argv[2]));
+    if (argc > 3) config.topics = static_cast<uint32_t>(std::atoi(argv[3]));
+    if (argc > 4) config.threads = std::atoi(argv[4]);
+    if (argc > 5) config.affinity = std::atoi(argv[5]) != 0;
+    if (argc > 6) config.lanes = std::atoi(argv[6]) != 0;
+    std::cout << config.producers << " producers x " << config.messages << " messages over " << config.topics
+        << " topics, " << config.threads << " threads" << (config.affinity ? ", affinity" : "")
+        << (config.lanes ? ", lanes" : "") << std::endl;
+
+    Failure failure;
+    MessageBus<TestMessage> message_bus;
+    CoExecutor co_executor(config.threads);
+    co_executor.set_affinity(config.affinity);
+    co_executor.start();
+    CancellationSource cancel;
+
+    std::vector<std::string> topics;
+    std::vector<std::unique_ptr<OrderedSubscriber>> subscribers;
+    std::vector<std::unique_ptr<SharedGroup>> groups;
+    std::atomic<uint32_t> once_completed{0};
+    for (uint32_t t = 0; t < config.topics; ++t)
+    {
+        topics.push_back("topic" + std::to_string(t));
+        for (uint32_t i = 0; i < config.message_subscribers; ++i)
+        {
+            auto& subscriber = subscribers.emplace_back(std::make_unique<OrderedSubscriber>());
+            subscriber->next.assign(config.producers, 0);
+            if (i % 2 == 0)
+            {
+                ordered(&message_bus, &co_executor, topics.back(), subscriber.get(), cancel.token(), &failure);
+            }else
+            {
+                ordered_batch(&message_bus, &co_executor, topics.back(), subscriber.get(), cancel.token(), &failure);
+            }
+        }
+        auto& group = groups.emplace_back(std::make_unique<SharedGroup>(config.producers, config.messages));
+        for (uint32_t i = 0; i < config.shared_members; ++i)
+        {
+            shared_member(&message_bus, &co_executor, topics.back(), group.get(), cancel.token(), &failure);
+        }
+    }
+    std::thread dispatcher([&message_bus](){ message_bus.run(); });
+
+    auto begin = std::chrono::steady_clock::now();
+    for (uint32_t t = 0; t < config.topics; ++t)
+    {
+        once_checker(&message_bus, &co_executor, "once" + std::to_string(t), config.once_rounds, &once_completed, &failure);
+    }
+    std::vector<std::thread> producers;
+    for (uint32_t p = 0; p < config.producers; ++p)
+    {
+        producers.emplace_back([&, p]()
+        {
+            std::vector<uint32_t> seq(config.topics, 0);
+            MessageBus<TestMessage>::Publisher publisher;
+            if (config.lanes)
+            {
+                publisher = message_bus.register_publisher("producer" + std::to_string(p), 1024);
+            }
+            for (uint32_t i = 0; i < config.messages * config.topics; ++i)
+            {
+                uint32_t t = (i * 7 + p) % config.topics;
+                TestMessage msg;
+                msg.name = topics[t];
+                Payload payload{p, seq[t]++};
+                msg.data.assign(reinterpret_cast<const char*>(&payload), sizeof(payload));
+                if (publisher)
+                {
+                    publisher.push_message(std::move(msg));
+                }else
+                {
+                    message_bus.push_message(std::move(msg));
+                }
+            }
+        });
+    }
+    for (auto& producer : producers)
+    {
+        producer.join();
+    }
+
+    uint64_t expected = static_cast<uint64_t>(config.producers) * config.messages;
+    auto done = [&]() {
+        for (auto& subscriber : subscribers)
+        {
+            if (subscriber->received.load() < expected) return false;
+        }
+        for (auto& group : groups)
+        {
+            if (group->received.load() < expected) return false;
+        }
+        return once_completed.load() == config.once_rounds * config.topics;
+    };
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(60);
+    while (!done() && !failure.failed && std::chrono::steady_clock::now() < deadline)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+    // let anything still in flight land, so a duplicate after the last expected message is caught
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    for (std::size_t i = 0; i < subscribers.size(); ++i)
+    {
+        if (subscribers[i]->received.load() != expected)
+        {
+            failure.report(topics[i / config.message_subscribers] + ": subscriber " + std::to_string(i) + " received " +
+                std::to_string(subscribers[i]->received.load()) + " of " + std::to_string(expected));
+        }
+    }
+    for (std::size_t t = 0; t < groups.size(); ++t)
+    {
+        if (groups[t]->received.load() != expected)
+        {
+            failure.report(topics[t] + ": shared group received " + std::to_string(groups[t]->received.load()) +
+                " of " + std::to_string(expected));
+        }
+    }
+    if (once_completed.load() != config.once_rounds * config.topics)
+    {
+        failure.report("once awaits completed " + std::to_string(once_completed.load()) + " of " +
+            std::to_string(config.once_rounds * config.topics) + " rounds");
+    }
+
+    cancel.cancel();
+    message_bus.stop();
+    dispatcher.join();
+    co_executor.drain(std::chrono::seconds(5));
+
+    if (failure.failed)
+    {
+        std::cout << "FAILED: " << failure.first << std::endl;
+        return 1;
+    }
+    uint64_t deliveries = expected * config.topics * (config.message_subscribers + 1);
+    std::cout << "ok: " << deliveries << " deliveries in " << seconds << "s ("
+        << static_cast<uint64_t>(deliveries / seconds) << "/s)" << std::endl;
+    return 0;
+}
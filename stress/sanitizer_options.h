@@ -0,0 +1,15 @@
+#pragma once
+
+
+// Included once by each stress harness. ThreadSanitizer and UBSan report and carry on by
+// default, so a run with a data race could still print "ok" and only differ in its exit status;
+// with these a report ends the run right there, non-zero. Only a sanitizer runtime calls them.
+extern "C" __attribute__((used)) const char* __tsan_default_options()
+{
+    return "halt_on_error=1";
+}
+
+extern "C" __attribute__((used)) const char* __ubsan_default_options()
+{
+    return "halt_on_error=1:print_stacktrace=1";
+}
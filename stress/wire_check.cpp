@@ -0,0 +1,217 @@
+#include "messagebus.h"
+#include "sim_executor.h"
+#include "sanitizer_options.h"
+#include <iostream>
+#include <random>
+
+
+// Wire format round trip and rejection run over a schema with scalar, bool, enum, string and
+// vector fields. Checks that:
+//   - encode, WireView::from, get<> and decode give back every field, empty strings and
+//     vectors included
+//   - from() rejects every truncation of a valid buffer, trailing bytes, a wrong header,
+//     string/vector slots pointing into the fixed section or past the end, and a bool byte
+//     other than 0 or 1
+//   - after random byte corruption from() either rejects the buffer or every field it hands
+//     out lies inside it
+//   - a WireMessage published on a bus, inline or spilled, is read back through view<T>()
+// Exits non-zero on the first violated check.
+//
+//   wire_check [corruption rounds]
+
+enum class Side : uint8_t
+{
+    Buy = 1,
+    Sell = 2,
+};
+
+struct Quote
+{
+    std::string symbol;
+    double price = 0;
+    uint32_t size = 0;
+    Side side = Side::Buy;
+    std::vector<int64_t> levels;
+    SmallString<16> venue;
+    bool firm = false;
+};
+
+template<>
+struct WireSchema<Quote> : WireFields<&Quote::symbol, &Quote::price, &Quote::size, &Quote::side, &Quote::levels, &Quote::venue,
+    &Quote::firm>
+{
+};
+
+static std::string first_failure;
+
+static void check(bool condition, const std::string& what)
+{
+    if (!condition && first_failure.empty())
+    {
+        first_failure = what;
+    }
+}
+
+static bool same(const Quote& a, const Quote& b)
+{
+    return a.symbol == b.symbol && a.price == b.price && a.size == b.size && a.side == b.side &&
+        a.levels == b.levels && a.venue.view() == b.venue.view() && a.firm == b.firm;
+}
+
+static void check_round_trip(const Quote& quote, const std::string& name)
+{
+    std::string bytes = wire_encode(quote);
+    check(bytes.size() == wire_size(quote), name + ": encoded size differs from wire_size");
+    auto view = WireView<Quote>::from(bytes);
+    if (!view)
+    {
+        check(false, name + ": valid encoding rejected");
+        return;
+    }
+    check(view.get<&Quote::symbol>() == quote.symbol, name + ": symbol");
+    check(view.get<&Quote::price>() == quote.price, name + ": price");
+    check(view.get<&Quote::size>() == quote.size, name + ": size");
+    check(view.get<&Quote::side>() == quote.side, name + ": side");
+    check(view.get<&Quote::levels>().to_vector() == quote.levels, name + ": levels");
+    check(view.get<&Quote::venue>() == quote.venue.view(), name + ": venue");
+    check(view.get<&Quote::firm>() == quote.firm, name + ": firm");
+    check(same(view.decode(), quote), name + ": decode");
+}
+
+// a view from() accepted must only ever point inside the bytes it was given
+static bool inside(const WireView<Quote>& view)
+{
+    const char* begin = view.bytes().data();
+    const char* end = begin + view.bytes().size();
+    auto within = [&](const char* data, std::size_t size) {
+        return data >= begin && data <= end && size <= static_cast<std::size_t>(end - data);
+    };
+    std::string_view symbol = view.get<&Quote::symbol>();
+    std::string_view venue = view.get<&Quote::venue>();
+    auto levels = view.get<&Quote::levels>();
+    const char* levels_data = begin + wire_detail::load<uint32_t>(begin + wire_detail::LayoutOf<Quote>::offsets[4]);
+    return within(symbol.data(), symbol.size()) && within(venue.data(), venue.size()) &&
+        within(levels_data, levels.size() * sizeof(int64_t));
+}
+
+static void check_rejects(const std::string& valid)
+{
+    using Layout = wire_detail::LayoutOf<Quote>;
+    for (std::size_t size = 0; size < valid.size(); ++size)
+    {
+        check(!WireView<Quote>::from(std::string_view(valid).substr(0, size)),
+            "truncation to " + std::to_string(size) + " of " + std::to_string(valid.size()) + " bytes accepted");
+    }
+    check(!WireView<Quote>::from(valid + std::string(8, '\0')), "trailing bytes accepted");
+
+    auto corrupt = [&valid](std::size_t at, auto value) {
+        std::string bytes = valid;
+        wire_detail::store(bytes.data() + at, value);
+        return bytes;
+    };
+    check(!WireView<Quote>::from(corrupt(0, static_cast<uint32_t>(valid.size() + 8))), "wrong total size accepted");
+    check(!WireView<Quote>::from(corrupt(4, static_cast<uint16_t>(Layout::field_num + 1))), "wrong field count accepted");
+    check(!WireView<Quote>::from(corrupt(6, static_cast<uint16_t>(Layout::fixed_size + 8))), "wrong fixed size accepted");
+    // slot 0 is the symbol string, slot 4 the levels vector
+    for (std::size_t field : {std::size_t(0), std::size_t(4)})
+    {
+        std::size_t slot = Layout::offsets[field];
+        std::string name = "field " + std::to_string(field);
+        check(!WireView<Quote>::from(corrupt(slot, static_cast<uint32_t>(0))), name + ": offset into the header accepted");
+        check(!WireView<Quote>::from(corrupt(slot, static_cast<uint32_t>(Layout::fixed_size - 8))),
+            name + ": offset into the fixed section accepted");
+        check(!WireView<Quote>::from(corrupt(slot, static_cast<uint32_t>(valid.size() + 1))), name + ": offset past the end accepted");
+        check(!WireView<Quote>::from(corrupt(slot + 4, static_cast<uint32_t>(valid.size()))), name + ": count past the end accepted");
+        check(!WireView<Quote>::from(corrupt(slot + 4, UINT32_MAX)), name + ": huge count accepted");
+    }
+    // slot 6 is the firm bool, only 0 and 1 are bools
+    check(!WireView<Quote>::from(corrupt(Layout::offsets[6], static_cast<uint8_t>(2))), "bool byte 2 accepted");
+    check(!WireView<Quote>::from(corrupt(Layout::offsets[6], static_cast<uint8_t>(0xff))), "bool byte 0xff accepted");
+    check(static_cast<bool>(WireView<Quote>::from(corrupt(Layout::offsets[6], static_cast<uint8_t>(1)))), "bool byte 1 rejected");
+}
+
+static void check_corruption(const std::string& valid, uint32_t rounds)
+{
+    std::mt19937_64 random(1);
+    uint32_t accepted = 0;
+    for (uint32_t round = 0; round < rounds && first_failure.empty(); ++round)
+    {
+        std::string bytes = valid;
+        int flips = 1 + static_cast<int>(random() % 4);
+        for (int i = 0; i < flips; ++i)
+        {
+            bytes[random() % bytes.size()] ^= static_cast<char>(1 + random() % 255);
+        }
+        if (auto view = WireView<Quote>::from(bytes))
+        {
+            ++accepted;
+            check(inside(view), "corruption round " + std::to_string(round) + " yields a field outside the buffer");
+        }
+    }
+    std::cout << "  " << rounds << " corrupted buffers, " << accepted << " still well-formed" << std::endl;
+}
+
+CoTask receive(MessageBus<WireMessage>* message_bus, CoExecutor* co_executor, std::vector<Quote>* received)
+{
+    auto await = message_bus->create_message_await(co_executor, "quotes");
+    while (true)
+    {
+        WireMessage msg = co_await await;
+        if (await.cancelled()) break;
+        auto view = msg.view<Quote>();
+        check(static_cast<bool>(view), "bus: payload spilled " + std::to_string(msg.data.spilled()) + " rejected");
+        if (view)
+        {
+            received->push_back(view.decode());
+        }
+    }
+}
+
+static void check_bus(const std::vector<Quote>& quotes)
+{
+    SimExecutor sim(0);
+    MessageBus<WireMessage> message_bus;
+    sim.add_source([&message_bus]() { return message_bus.dispatch_one(); });
+    std::vector<Quote> received;
+    receive(&message_bus, &sim, &received);
+    for (const Quote& quote : quotes)
+    {
+        message_bus.push_message(WireMessage("quotes", quote));
+    }
+    sim.run();
+    check(received.size() == quotes.size(), "bus: received " + std::to_string(received.size()) + " of " + std::to_string(quotes.size()));
+    for (std::size_t i = 0; i < received.size() && i < quotes.size(); ++i)
+    {
+        check(same(received[i], quotes[i]), "bus: message " + std::to_string(i) + " differs");
+    }
+}
+
+int main(int argc, char** argv)
+{
+    uint32_t rounds = argc > 1 ? static_cast<uint32_t>(std::atoi(argv[1])) : 200000;
+
+    Quote empty;
+    Quote small{"ACME", 101.25, 300, Side::Sell, {1, -2, 3}, "XNAS", true};
+    Quote large{std::string(300, 's'), -0.5, UINT32_MAX, Side::Buy, {}, "venue-with-16-ch", false};
+    for (int64_t i = 0; i < 100; ++i)
+    {
+        large.levels.push_back(i * INT64_C(1000000007));
+    }
+    std::cout << "wire sizes: empty " << wire_size(empty) << ", small " << wire_size(small) << ", large " << wire_size(large) << std::endl;
+
+    check_round_trip(empty, "empty");
+    check_round_trip(small, "small");
+    check_round_trip(large, "large");
+    check_rejects(wire_encode(small));
+    check_rejects(wire_encode(large));
+    check_corruption(wire_encode(small), rounds);
+    check_bus({small, empty, large, small});
+
+    if (!first_failure.empty())
+    {
+        std::cout << "FAILED: " << first_failure << std::endl;
+        return 1;
+    }
+    std::cout << "ok" << std::endl;
+    return 0;
+}
@@ -0,0 +1,72 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <string_view>
+
+
+// Topic name usable as a template argument, e.g. bus.push_message<"quotes">(std::move(quote)).
+template<std::size_t N>
+struct TopicName
+{
+    constexpr TopicName(const char (&name)[N])
+    {
+        std::copy_n(name, N, value);
+    }
+    constexpr std::string_view view() const
+    {
+        return {value, N - 1};
+    }
+    char value[N];
+};
+
+namespace topic_routes_detail
+{
+    template<std::size_t N>
+    constexpr bool distinct(const std::array<std::string_view, N>& names)
+    {
+        for (std::size_t i = 0; i < N; ++i)
+        {
+            for (std::size_t j = i + 1; j < N; ++j)
+            {
+                if (names[i] == names[j]) return false;
+            }
+        }
+        return true;
+    }
+}
+
+template<TopicName... Names>
+struct TopicList
+{
+    static constexpr std::size_t size = sizeof...(Names);
+    static constexpr std::array<std::string_view, size> names{Names.view()...};
+
+    // 1-based route of a declared topic, 0 for any other name
+    static constexpr std::size_t route(std::string_view name)
+    {
+        for (std::size_t i = 0; i < size; ++i)
+        {
+            if (names[i] == name)
+            {
+                return i + 1;
+            }
+        }
+        return 0;
+    }
+    template<TopicName Name>
+    static constexpr std::size_t route_of = route(Name.view());
+
+    static_assert(topic_routes_detail::distinct(names), "topic declared twice");
+};
+
+// Topics of a message type that are known at build time. A bus gives each one a fixed slot
+// for its subscribers and traffic counters, and a message's slot is picked once when it is
+// published, so dispatching it indexes an array instead of hashing the name into the
+// subscriber and traffic maps. Every other name keeps using the maps. Specialize next to the
+// message type, so every translation unit sees the same list:
+//     template<> struct StaticTopics<Quote> : TopicList<"quotes", "trades"> {};
+template<typename T>
+struct StaticTopics : TopicList<>
+{
+};
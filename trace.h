@@ -0,0 +1,320 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+
+enum class TraceKind : uint8_t
+{
+    Publish = 0,
+    DispatchBegin = 1,
+    DispatchEnd = 2,
+    ResumeEnqueued = 3,
+    ResumeBegin = 4,
+    ResumeEnd = 5,     // the coroutine suspended again or finished
+};
+
+struct TraceEvent
+{
+    uint64_t ts_ns;
+    uint64_t flow;      // 0 when the event isn't tied to a message
+    const char* label;  // interned topic name or nullptr
+    TraceKind kind;
+};
+
+
+// Optional timeline recorder. Every thread writes fixed-size events into its own ring, so
+// recording is a clock read and a store; when disabled each trace point is one relaxed load.
+// The ring of a thread that exits is handed to the next thread that starts recording, so
+// thread churn doesn't grow the rings past the most threads alive at once.
+// write_chrome_trace renders all rings as Chrome trace JSON (chrome://tracing, ui.perfetto.dev)
+// with flow arrows following each message from publish to the handlers it resumed.
+class Tracer
+{
+    public:
+    static Tracer& instance()
+    {
+        static Tracer tracer;
+        return tracer;
+    }
+
+    static bool enabled()
+    {
+        return instance().enabled_.load(std::memory_order_relaxed);
+    }
+
+    // ring_capacity applies to rings created for threads that record for the first time after this call
+    void enable(std::size_t ring_capacity = 1 << 16)
+    {
+        ring_capacity_.store(ring_capacity, std::memory_order_relaxed);
+        enabled_.store(true, std::memory_order_relaxed);
+    }
+    void disable()
+    {
+        enabled_.store(false, std::memory_order_relaxed);
+    }
+
+    // flow ids are handed out in per-thread blocks so publishers don't share a counter
+    uint64_t new_flow()
+    {
+        static thread_local uint64_t next = 0;
+        static thread_local uint64_t limit = 0;
+        if (next == limit)
+        {
+            next = next_flow_block_.fetch_add(kFlowBlock, std::memory_order_relaxed);
+            limit = next + kFlowBlock;
+        }
+        return next++;
+    }
+
+    // flow of the message this thread is dispatching, stamped onto the coroutines it schedules
+    static uint64_t& current_flow()
+    {
+        static thread_local uint64_t flow = 0;
+        return flow;
+    }
+
+    void record(TraceKind kind, uint64_t flow, const char* label = nullptr)
+    {
+        auto ts = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+        ring().push({static_cast<uint64_t>(ts), flow, label, kind});
+    }
+
+    // stable pointer for a topic name; cached per thread since consecutive messages often share a topic
+    const char* intern(std::string_view name)
+    {
+        static thread_local std::string last_name;
+        static thread_local const char* last_label = nullptr;
+        if (last_label && last_name == name)
+        {
+            return last_label;
+        }
+        std::lock_guard lk(mutex_);
+        last_name = name;
+        last_label = labels_.emplace(name).first->c_str();
+        return last_label;
+    }
+
+    // Safe while threads still record; an event overwritten while it is copied is dropped, not torn.
+    void write_chrome_trace(std::ostream& out)
+    {
+        std::vector<std::shared_ptr<Ring>> rings;
+        {
+            std::lock_guard lk(mutex_);
+            rings = rings_;
+        }
+        out << "{\"traceEvents\":[";
+        bool first = true;
+        auto begin = [&out, &first]() -> std::ostream& {
+            out << (first ? "\n" : ",\n");
+            first = false;
+            return out;
+        };
+        for (auto& ring : rings)
+        {
+            begin() << "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":" << ring->tid
+                << ",\"args\":{\"name\":\"thread " << ring->tid << "\"}}";
+            for (const TraceEvent& e : ring->snapshot())
+            {
+                write_event(begin(), e, ring->tid);
+                if (e.flow && e.kind != TraceKind::DispatchEnd && e.kind != TraceKind::ResumeEnd)
+                {
+                    write_flow(begin(), e, ring->tid);
+                }
+            }
+        }
+        out << "\n]}\n";
+    }
+
+    private:
+    static constexpr uint64_t kFlowBlock = 1024;
+
+    // One writer thread, any number of readers. Each slot is a small seqlock: seq is 0 while
+    // the writer fills it and index + 1 once event number index is complete, so a reader keeps
+    // a copy only if seq named the event it wanted both before and after reading the fields.
+    // Fields are stored release and loaded acquire in place of fences: a reader that sees any
+    // field of a newer event also sees the seq reset ahead of it.
+    struct Ring
+    {
+        Ring(std::size_t capacity, uint32_t tid_):
+            slots(std::max<std::size_t>(capacity, 1)),
+            tid(tid_)
+        {
+        }
+        void push(const TraceEvent& event)
+        {
+            uint64_t h = head.load(std::memory_order_relaxed);
+            Slot& slot = slots[h % slots.size()];
+            slot.seq.store(0, std::memory_order_relaxed);
+            slot.ts_ns.store(event.ts_ns, std::memory_order_release);
+            slot.flow.store(event.flow, std::memory_order_release);
+            slot.label.store(event.label, std::memory_order_release);
+            slot.kind.store(event.kind, std::memory_order_release);
+            slot.seq.store(h + 1, std::memory_order_release);
+            head.store(h + 1, std::memory_order_release);
+        }
+        std::vector<TraceEvent> snapshot() const
+        {
+            uint64_t end = head.load(std::memory_order_acquire);
+            uint64_t begin = end > slots.size() ? end - slots.size() : 0;
+            std::vector<TraceEvent> result;
+            result.reserve(end - begin);
+            for (uint64_t i = begin; i < end; ++i)
+            {
+                const Slot& slot = slots[i % slots.size()];
+                if (slot.seq.load(std::memory_order_acquire) != i + 1)
+                {
+                    continue;
+                }
+                TraceEvent event{slot.ts_ns.load(std::memory_order_acquire), slot.flow.load(std::memory_order_acquire),
+                    slot.label.load(std::memory_order_acquire), slot.kind.load(std::memory_order_acquire)};
+                // the writer lapped us while we copied
+                if (slot.seq.load(std::memory_order_relaxed) != i + 1)
+                {
+                    continue;
+                }
+                result.push_back(event);
+            }
+            return result;
+        }
+
+        struct Slot
+        {
+            std::atomic<uint64_t> seq{0};
+            std::atomic<uint64_t> ts_ns{0};
+            std::atomic<uint64_t> flow{0};
+            std::atomic<const char*> label{nullptr};
+            std::atomic<TraceKind> kind{TraceKind::Publish};
+        };
+
+        std::vector<Slot> slots;
+        std::atomic<uint64_t> head{0};
+        uint32_t tid;
+    };
+
+    Tracer() = default;
+
+    // gives the ring back when its thread exits
+    struct RingOwner
+    {
+        std::shared_ptr<Ring> ring;
+        ~RingOwner()
+        {
+            if (ring) instance().release(std::move(ring));
+        }
+    };
+
+    Ring& ring()
+    {
+        static thread_local RingOwner owner;
+        if (!owner.ring)
+        {
+            owner.ring = acquire();
+        }
+        return *owner.ring;
+    }
+
+    // a released ring of the current capacity, events of its last thread still in it, or a new one
+    std::shared_ptr<Ring> acquire()
+    {
+        std::size_t capacity = std::max<std::size_t>(ring_capacity_.load(std::memory_order_relaxed), 1);
+        std::lock_guard lk(mutex_);
+        while (!free_rings_.empty())
+        {
+            std::shared_ptr<Ring> ring = std::move(free_rings_.back());
+            free_rings_.pop_back();
+            if (ring->slots.size() == capacity)
+            {
+                return ring;
+            }
+            std::erase(rings_, ring);
+        }
+        auto ring = std::make_shared<Ring>(capacity, next_tid_++);
+        rings_.push_back(ring);
+        return ring;
+    }
+
+    // stays in rings_, so what its thread recorded is still exported until a new owner overwrites it
+    void release(std::shared_ptr<Ring> ring)
+    {
+        std::lock_guard lk(mutex_);
+        free_rings_.push_back(std::move(ring));
+    }
+
+    static const char* kind_name(TraceKind kind)
+    {
+        switch (kind)
+        {
+            case TraceKind::Publish: return "publish";
+            case TraceKind::DispatchBegin:
+            case TraceKind::DispatchEnd: return "dispatch";
+            case TraceKind::ResumeEnqueued: return "resume enqueued";
+            case TraceKind::ResumeBegin:
+            case TraceKind::ResumeEnd: return "resume";
+        }
+        return "";
+    }
+
+    static void write_common(std::ostream& out, const TraceEvent& e, uint32_t tid)
+    {
+        out << "\"pid\":1,\"tid\":" << tid << ",\"ts\":" << e.ts_ns / 1000 << '.'
+            << static_cast<char>('0' + e.ts_ns / 100 % 10) << static_cast<char>('0' + e.ts_ns / 10 % 10)
+            << static_cast<char>('0' + e.ts_ns % 10);
+    }
+
+    static void write_event(std::ostream& out, const TraceEvent& e, uint32_t tid)
+    {
+        const char* ph = "i";
+        if (e.kind == TraceKind::DispatchBegin || e.kind == TraceKind::ResumeBegin) ph = "B";
+        if (e.kind == TraceKind::DispatchEnd || e.kind == TraceKind::ResumeEnd) ph = "E";
+        out << "{\"ph\":\"" << ph << "\",\"name\":\"" << kind_name(e.kind) << "\",\"cat\":\"bus\",";
+        if (*ph == 'i') out << "\"s\":\"t\",";
+        write_common(out, e, tid);
+        if (e.flow || e.label)
+        {
+            out << ",\"args\":{\"flow\":" << e.flow;
+            if (e.label) out << ",\"topic\":\"" << escape(e.label) << '"';
+            out << '}';
+        }
+        out << '}';
+    }
+
+    // publish opens the flow; dispatch, enqueue and resume are steps bound to their slices
+    static void write_flow(std::ostream& out, const TraceEvent& e, uint32_t tid)
+    {
+        out << "{\"ph\":\"" << (e.kind == TraceKind::Publish ? 's' : 't') << "\",\"name\":\"message\",\"cat\":\"flow\",\"id\":"
+            << e.flow << ",\"bp\":\"e\",";
+        write_common(out, e, tid);
+        out << '}';
+    }
+
+    static std::string escape(std::string_view text)
+    {
+        std::string result;
+        for (char c : text)
+        {
+            if (c == '"' || c == '\\') result.push_back('\\');
+            if (static_cast<unsigned char>(c) < 0x20) continue;
+            result.push_back(c);
+        }
+        return result;
+    }
+
+    std::atomic<bool> enabled_{false};
+    std::atomic<std::size_t> ring_capacity_{1 << 16};
+    std::atomic<uint64_t> next_flow_block_{1};
+    std::mutex mutex_;
+    std::vector<std::shared_ptr<Ring>> rings_;
+    std::vector<std::shared_ptr<Ring>> free_rings_;
+    uint32_t next_tid_ = 1;
+    std::unordered_set<std::string> labels_;
+};
@@ -0,0 +1,395 @@
+#pragma once
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "bus_message.h"
+
+
+// Flat binary form of a message type that is read in place, never decoded into an object.
+//
+// Declare the fields once by deriving the schema from their member pointers:
+//     template<> struct WireSchema<Quote> : WireFields<&Quote::symbol, &Quote::price, &Quote::size> {};
+//
+// Layout: u32 total size | u16 field count | u16 fixed section size, then one slot per field in
+// declaration order at its natural alignment, then the variable-size bytes. Scalars (arithmetic
+// and enum) live in their slot; strings (anything convertible to std::string_view) and vectors
+// of scalars store {u32 offset, u32 count} there and their bytes, 8-aligned, in the tail.
+// Numbers are in host order, little-endian on every target the bus builds for.
+static_assert(std::endian::native == std::endian::little, "wire format assumes a little-endian host");
+
+template<auto... Members>
+struct WireFields
+{
+};
+
+template<typename T>
+struct WireSchema;
+
+namespace wire_detail
+{
+    constexpr std::size_t kHeaderSize = 8;
+    constexpr std::size_t kTailAlign = 8;
+
+    template<auto Member>
+    struct FieldOf;
+    template<typename C, typename F, F C::* Member>
+    struct FieldOf<Member>
+    {
+        using type = F;
+    };
+    template<auto Member>
+    using FieldType = typename FieldOf<Member>::type;
+
+    template<typename F>
+    constexpr bool is_scalar = std::is_arithmetic_v<F> || std::is_enum_v<F>;
+
+    template<typename F>
+    struct VectorElement
+    {
+        using type = void;
+    };
+    template<typename E, typename A>
+    struct VectorElement<std::vector<E, A>>
+    {
+        using type = E;
+    };
+    template<typename F>
+    constexpr bool is_vector = is_scalar<typename VectorElement<F>::type>;
+
+    template<typename F>
+    constexpr bool is_string = !is_scalar<F> && !is_vector<F> && std::is_convertible_v<const F&, std::string_view>;
+
+    template<typename F>
+    constexpr std::size_t slot_size()
+    {
+        static_assert(is_scalar<F> || is_vector<F> || is_string<F>, "unsupported wire field type");
+        if constexpr (is_scalar<F>) return sizeof(F);
+        else return 8;
+    }
+    template<typename F>
+    constexpr std::size_t slot_align()
+    {
+        if constexpr (is_scalar<F>) return alignof(F);
+        else return 4;
+    }
+    constexpr std::size_t align_up(std::size_t value, std::size_t alignment)
+    {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+
+    template<auto A, auto B>
+    constexpr bool same_member()
+    {
+        if constexpr (std::is_same_v<decltype(A), decltype(B)>) return A == B;
+        else return false;
+    }
+
+    // picks the WireFields base out of a WireSchema specialization
+    template<auto... Members>
+    WireFields<Members...> fields_of(const WireFields<Members...>&);
+
+    template<typename Fields>
+    struct Layout;
+    template<auto... Members>
+    struct Layout<WireFields<Members...>>
+    {
+        static constexpr std::size_t field_num = sizeof...(Members);
+        static constexpr std::array<std::size_t, field_num> sizes{slot_size<FieldType<Members>>()...};
+        static constexpr std::array<std::size_t, field_num> aligns{slot_align<FieldType<Members>>()...};
+        static constexpr std::array<std::size_t, field_num> offsets = []{
+            std::array<std::size_t, field_num> result{};
+            std::size_t offset = kHeaderSize;
+            for (std::size_t i = 0; i < field_num; ++i)
+            {
+                offset = align_up(offset, aligns[i]);
+                result[i] = offset;
+                offset += sizes[i];
+            }
+            return result;
+        }();
+        static constexpr std::size_t fixed_size = align_up(field_num ? offsets[field_num - 1] + sizes[field_num - 1] : kHeaderSize, kTailAlign);
+        static_assert(fixed_size <= UINT16_MAX, "too many wire fields");
+
+        template<std::size_t I>
+        static constexpr auto member = std::get<I>(std::make_tuple(Members...));
+
+        template<auto Member>
+        static constexpr std::size_t index = []{
+            constexpr std::array<bool, field_num> matches{same_member<Member, Members>()...};
+            std::size_t i = 0;
+            while (i < field_num && !matches[i]) ++i;
+            return i;
+        }();
+    };
+
+    template<typename T>
+    using LayoutOf = Layout<decltype(fields_of(std::declval<WireSchema<T>>()))>;
+
+    template<typename V>
+    V load(const char* p)
+    {
+        // any byte other than 0 or 1 copied into a bool would be an invalid bool
+        if constexpr (std::is_same_v<V, bool>)
+        {
+            return load<uint8_t>(p) != 0;
+        }else
+        {
+            V value;
+            std::memcpy(&value, p, sizeof(V));
+            return value;
+        }
+    }
+    template<typename V>
+    void store(char* p, V value)
+    {
+        std::memcpy(p, &value, sizeof(V));
+    }
+
+    template<typename F>
+    std::size_t tail_size(const F& field)
+    {
+        if constexpr (is_string<F>) return align_up(std::string_view(field).size(), kTailAlign);
+        else if constexpr (is_vector<F>) return align_up(field.size() * sizeof(typename VectorElement<F>::type), kTailAlign);
+        else return 0;
+    }
+}
+
+
+// Read-only view of a vector field; elements are copied out on access since the buffer
+// holding the message doesn't have to be aligned.
+template<typename E>
+class WireArray
+{
+    public:
+    WireArray() = default;
+    WireArray(const char* data, std::size_t size):
+        data_(data),
+        size_(size)
+    {
+    }
+    E operator[](std::size_t i) const
+    {
+        return wire_detail::load<E>(data_ + i * sizeof(E));
+    }
+    std::size_t size() const
+    {
+        return size_;
+    }
+    bool empty() const
+    {
+        return size_ == 0;
+    }
+    std::vector<E> to_vector() const
+    {
+        std::vector<E> result(size_);
+        std::memcpy(result.data(), data_, size_ * sizeof(E));
+        return result;
+    }
+
+    private:
+    const char* data_ = nullptr;
+    std::size_t size_ = 0;
+};
+
+
+template<typename T>
+std::size_t wire_size(const T& message)
+{
+    using Layout = wire_detail::LayoutOf<T>;
+    return [&]<std::size_t... I>(std::index_sequence<I...>) {
+        return Layout::fixed_size + (wire_detail::tail_size(message.*Layout::template member<I>) + ... + 0);
+    }(std::make_index_sequence<Layout::field_num>{});
+}
+
+// out must hold wire_size(message) bytes; returns the number written
+template<typename T>
+std::size_t wire_encode(const T& message, char* out)
+{
+    using Layout = wire_detail::LayoutOf<T>;
+    std::memset(out, 0, Layout::fixed_size);
+    std::size_t tail = Layout::fixed_size;
+    [&]<std::size_t... I>(std::index_sequence<I...>) {
+        ([&]{
+            const auto& field = message.*Layout::template member<I>;
+            using F = std::remove_cvref_t<decltype(field)>;
+            char* slot = out + Layout::offsets[I];
+            if constexpr (wire_detail::is_scalar<F>)
+            {
+                wire_detail::store(slot, field);
+            }else
+            {
+                const char* bytes;
+                std::size_t count;
+                std::size_t size;
+                if constexpr (wire_detail::is_string<F>)
+                {
+                    std::string_view view(field);
+                    bytes = view.data();
+                    count = size = view.size();
+                }else
+                {
+                    bytes = reinterpret_cast<const char*>(field.data());
+                    count = field.size();
+                    size = count * sizeof(typename wire_detail::VectorElement<F>::type);
+                }
+                wire_detail::store(slot, static_cast<uint32_t>(tail));
+                wire_detail::store(slot + 4, static_cast<uint32_t>(count));
+                std::memcpy(out + tail, bytes, size);
+                std::memset(out + tail + size, 0, wire_detail::align_up(size, wire_detail::kTailAlign) - size);
+                tail += wire_detail::align_up(size, wire_detail::kTailAlign);
+            }
+        }(), ...);
+    }(std::make_index_sequence<Layout::field_num>{});
+    wire_detail::store(out, static_cast<uint32_t>(tail));
+    wire_detail::store(out + 4, static_cast<uint16_t>(Layout::field_num));
+    wire_detail::store(out + 6, static_cast<uint16_t>(Layout::fixed_size));
+    return tail;
+}
+
+template<typename T>
+std::string wire_encode(const T& message)
+{
+    std::string out(wire_size(message), '\0');
+    wire_encode(message, out.data());
+    return out;
+}
+
+
+// In-place reader over encoded bytes. from() checks the header, every offset and every bool
+// byte once, so a view built from untrusted bytes (a bridge, a journal) is either valid or
+// empty; field reads are then a load at a compile-time offset. The bytes must outlive the view.
+template<typename T>
+class WireView
+{
+    using Layout = wire_detail::LayoutOf<T>;
+
+    public:
+    WireView() = default;
+
+    static WireView from(std::string_view bytes)
+    {
+        using namespace wire_detail;
+        if (bytes.size() < Layout::fixed_size || load<uint32_t>(bytes.data()) != bytes.size() ||
+            load<uint16_t>(bytes.data() + 4) != Layout::field_num || load<uint16_t>(bytes.data() + 6) != Layout::fixed_size)
+        {
+            return {};
+        }
+        bool valid = [&]<std::size_t... I>(std::index_sequence<I...>) {
+            return ([&]{
+                using F = FieldType<Layout::template member<I>>;
+                if constexpr (std::is_same_v<F, bool>)
+                {
+                    return load<uint8_t>(bytes.data() + Layout::offsets[I]) <= 1;
+                }else if constexpr (is_scalar<F>)
+                {
+                    return true;
+                }else
+                {
+                    std::size_t element = 1;
+                    if constexpr (is_vector<F>) element = sizeof(typename VectorElement<F>::type);
+                    std::size_t offset = load<uint32_t>(bytes.data() + Layout::offsets[I]);
+                    std::size_t count = load<uint32_t>(bytes.data() + Layout::offsets[I] + 4);
+                    return offset >= Layout::fixed_size && offset <= bytes.size() && count * element <= bytes.size() - offset;
+                }
+            }() && ...);
+        }(std::make_index_sequence<Layout::field_num>{});
+        return valid ? WireView(bytes) : WireView();
+    }
+
+    explicit operator bool() const
+    {
+        return !bytes_.empty();
+    }
+    std::string_view bytes() const
+    {
+        return bytes_;
+    }
+
+    // get<&Quote::price>(): scalars by value, strings as std::string_view, vectors as WireArray
+    template<auto Member>
+        requires std::is_member_object_pointer_v<decltype(Member)>
+    auto get() const
+    {
+        constexpr std::size_t index = Layout::template index<Member>;
+        static_assert(index < Layout::field_num, "member is not in the wire schema");
+        return get<index>();
+    }
+    template<std::size_t I>
+    auto get() const
+    {
+        using namespace wire_detail;
+        using F = FieldType<Layout::template member<I>>;
+        const char* slot = bytes_.data() + Layout::offsets[I];
+        if constexpr (is_scalar<F>)
+        {
+            return load<F>(slot);
+        }else
+        {
+            const char* data = bytes_.data() + load<uint32_t>(slot);
+            std::size_t count = load<uint32_t>(slot + 4);
+            if constexpr (is_string<F>) return std::string_view(data, count);
+            else return WireArray<typename VectorElement<F>::type>(data, count);
+        }
+    }
+
+    // materializes a T, for code that needs the object after the bytes are gone
+    T decode() const
+    {
+        T message{};
+        [&]<std::size_t... I>(std::index_sequence<I...>) {
+            ([&]{
+                auto& field = message.*Layout::template member<I>;
+                using F = std::remove_cvref_t<decltype(field)>;
+                if constexpr (wire_detail::is_vector<F>) field = get<I>().to_vector();
+                else field = F(get<I>());
+            }(), ...);
+        }(std::make_index_sequence<Layout::field_num>{});
+        return message;
+    }
+
+    private:
+    explicit WireView(std::string_view bytes):
+        bytes_(bytes)
+    {
+    }
+
+    std::string_view bytes_;
+};
+
+
+// Bus message carrying a wire-encoded payload: publishing encodes once, straight into the
+// payload, and subscribers read fields through view<T>() in the frame that co_awaited it.
+// Bridges and journals forward name and data as plain bytes, so a message crossing processes
+// is never rebuilt as an object. One bus type serves every schema.
+//     MessageBus<WireMessage> bus;
+//     bus.push_message(WireMessage("quotes", quote));
+//     WireMessage msg = co_await await;
+//     if (auto quote = msg.view<Quote>()) total += quote.get<&Quote::price>();
+struct WireMessage
+{
+    WireMessage() = default;
+    template<typename T>
+    WireMessage(std::string_view topic, const T& message):
+        name(topic)
+    {
+        wire_encode(message, data.prepare(wire_size(message), topic));
+    }
+
+    // empty if the payload isn't a valid encoding of T
+    template<typename T>
+    WireView<T> view() const
+    {
+        return WireView<T>::from(data.view());
+    }
+
+    SmallString<32> name;
+    SmallString<192> data;
+};